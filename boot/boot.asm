@@ -34,7 +34,9 @@ _start:
     push 0
     popf
     
-    ; Call kernel
+    ; Call kernel: kmain(magic, multiboot_info)
+    push ebx
+    push eax
     call kmain
     
     ; Halt
@@ -0,0 +1,398 @@
+/**
+ * TarkOS - Hosted Benchmark Driver
+ * Runs kernel/lib/string.c, kernel/lib/printf.c, kernel/arch/i386/cpu.c,
+ * kernel/mm/pmm.c, kernel/mm/slab.c and the RAMDisk code from
+ * kernel/kernel.c as a normal Linux program, timed with the TSC.
+ *
+ * Usage: hostbench [-r reps] [filter]
+ *   filter  Only run benchmarks whose name contains this text
+ *
+ * Kernel symbols that clash with libc are renamed at compile time:
+ * kernel.c string helpers get a kernel_ prefix, kernel/lib ones lib_.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <x86intrin.h>
+
+/* kernel/kernel.c (compiled with -DTARKOS_HOSTED) */
+void* kernel_memcpy(void* d, const void* s, int n);
+void* kernel_memset(void* s, int c, int n);
+void fs_init(void);
+int fs_write_file(const char* name, const char* data, int size);
+int fs_append_file(const char* name, const char* data, int size);
+int fs_find_file(const char* name);
+
+/* kernel/arch/i386/cpu.c and kernel/lib/string.c (compiled with -DTARKOS_HOSTED) */
+void cpu_init(void);
+void string_init(void);
+void* lib_memcpy(void* dest, const void* src, uint32_t n);
+void* lib_memset(void* dest, int c, uint32_t n);
+void* lib_memsetl(void* dest, uint32_t val, uint32_t n);
+void* lib_memmove(void* dest, const void* src, uint32_t n);
+void* memblendl(uint32_t* dest, const uint32_t* src, uint32_t n);
+
+/* kernel/mm/pmm.c and the simulated memory map */
+uint32_t pmm_alloc_page(void);
+uint32_t pmm_alloc_pages(uint32_t count);
+void pmm_free_page(uint32_t addr);
+void hostbench_pmm_reset(uint32_t mem_mb);
+void hostbench_pmm_window(uint32_t base, uint32_t size);
+void* hostbench_pmm_virt(uint32_t addr);
+uint32_t hostbench_low_memory_end(void);
+uint32_t pmm_alloc_zeroed_page(void);
+uint8_t pmm_zero_idle(void);
+
+/* kernel/mm/slab.c */
+void slab_init(void);
+void* kmalloc(uint32_t size);
+void kfree(void* ptr);
+
+/* kernel/lib/printf.c */
+int lib_sprintf(char* buf, const char* fmt, ...);
+int lib_snprintf(char* buf, uint32_t size, const char* fmt, ...);
+
+#define WARMUP          3
+#define DEFAULT_REPS    31
+#define BIG             (1024 * 1024)
+#define SMALL           4096
+#define PMM_MEM_MB      512
+#define PMM_PAGES       16384
+#define FS_FILES        30      /* kernel.c MAX_FILES, less the two fs_init() creates */
+#define SLAB_WINDOW_SIZE (64 * 1024 * 1024)   /* Real memory behind slab pages */
+#define SLAB_OBJS       8192
+#define FMT_LINES       1000
+
+static uint8_t* buf_src;
+static uint8_t* buf_dst;
+static uint32_t pages[PMM_PAGES];
+static void* objs[SLAB_OBJS];
+static uint32_t slab_window;
+static char fs_names[FS_FILES][32];
+static char fs_data[512];
+static char fmt_buf[256];
+
+/**
+ * Back the slab window with real memory where the kernel code sees it, at
+ * its direct-map address; the first low-memory window that is free is used
+ * @return Physical base of the window, or 0
+ */
+static uint32_t map_slab_window(void) {
+    for (uint32_t base = 0x10000000; base <= hostbench_low_memory_end() - SLAB_WINDOW_SIZE;
+         base += SLAB_WINDOW_SIZE) {
+        void* want = hostbench_pmm_virt(base);
+        void* p = mmap(want, SLAB_WINDOW_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+        if (p == want) {
+            return base;
+        }
+        if (p != MAP_FAILED) {
+            munmap(p, SLAB_WINDOW_SIZE);  /* Kernel ignored the fixed hint */
+        }
+    }
+    return 0;
+}
+
+/**
+ * Serialised TSC read
+ */
+static inline uint64_t cycles(void) {
+    _mm_lfence();
+    uint64_t t = __rdtsc();
+    _mm_lfence();
+    return t;
+}
+
+/* ---- memory copy / fill ---- */
+static void copy_kernel_4k(void) { kernel_memcpy(buf_dst, buf_src, SMALL); }
+static void copy_kernel_1m(void) { kernel_memcpy(buf_dst, buf_src, BIG); }
+static void copy_lib_4k(void)    { lib_memcpy(buf_dst, buf_src, SMALL); }
+static void copy_lib_1m(void)    { lib_memcpy(buf_dst, buf_src, BIG); }
+static void copy_libc_4k(void)   { memcpy(buf_dst, buf_src, SMALL); }
+static void copy_libc_1m(void)   { memcpy(buf_dst, buf_src, BIG); }
+static void copy_lib_unaligned_1m(void) { lib_memcpy(buf_dst + 1, buf_src + 2, BIG - 2); }
+static void move_lib_1m(void)    { lib_memmove(buf_dst + 64, buf_dst, BIG - 64); }
+static void fill_kernel_1m(void) { kernel_memset(buf_dst, 0x5A, BIG); }
+static void fill_lib_1m(void)    { lib_memset(buf_dst, 0x5A, BIG); }
+static void fill_libc_1m(void)   { memset(buf_dst, 0x5A, BIG); }
+static void fill32_lib_1m(void)  { lib_memsetl(buf_dst, 0x00FF8800, BIG / 4); }
+static void blend_lib_1m(void)   { memblendl((uint32_t*)buf_dst, (const uint32_t*)buf_src, BIG / 4); }
+
+/* ---- physical memory manager ---- */
+static void pmm_fresh(void) { hostbench_pmm_reset(PMM_MEM_MB); }
+static void pmm_init_1g(void) { hostbench_pmm_reset(1024); }
+
+static void pmm_fill(void) {
+    for (int i = 0; i < PMM_PAGES; i++) {
+        pages[i] = pmm_alloc_page();
+    }
+}
+
+static void pmm_fresh_filled(void) {
+    pmm_fresh();
+    pmm_fill();
+}
+
+static void pmm_free_all(void) {
+    for (int i = 0; i < PMM_PAGES; i++) {
+        pmm_free_page(pages[i]);
+    }
+}
+
+static void pmm_contig(void) {
+    for (int i = 0; i < 256; i++) {
+        pmm_alloc_pages(16);
+    }
+}
+
+/* Half of RAM in use, then allocate/free pairs near the fill line */
+static void pmm_half_full(void) {
+    pmm_fresh();
+    pmm_alloc_pages((PMM_MEM_MB * 256) / 2);
+}
+
+static void pmm_churn(void) {
+    for (int i = 0; i < 4096; i++) {
+        pmm_free_page(pmm_alloc_page());
+    }
+}
+
+/* Zeroed pages: pool filled by the idle hook first, or zeroed on demand */
+#define ZERO_PAGES      32
+
+static void zero_fresh(void) {
+    hostbench_pmm_window(slab_window, SLAB_WINDOW_SIZE);
+}
+
+static void zero_fresh_pooled(void) {
+    zero_fresh();
+    while (pmm_zero_idle()) {
+    }
+}
+
+static void zero_alloc(void) {
+    for (int i = 0; i < ZERO_PAGES; i++) {
+        pages[i] = pmm_alloc_zeroed_page();
+    }
+}
+
+/* ---- slab allocator ---- */
+static void slab_fresh(void) {
+    hostbench_pmm_window(slab_window, SLAB_WINDOW_SIZE);
+    slab_init();
+}
+
+static void slab_fill(void) {
+    for (int i = 0; i < SLAB_OBJS; i++) {
+        objs[i] = kmalloc(64);
+    }
+}
+
+static void slab_fresh_filled(void) {
+    slab_fresh();
+    slab_fill();
+}
+
+static void slab_free_all(void) {
+    for (int i = 0; i < SLAB_OBJS; i++) {
+        kfree(objs[i]);
+    }
+}
+
+/* Mixed sizes, freed in allocation order */
+static void slab_mixed(void) {
+    for (int i = 0; i < SLAB_OBJS; i++) {
+        objs[i] = kmalloc(16 + (i * 37) % 1000);
+    }
+    for (int i = 0; i < SLAB_OBJS; i++) {
+        kfree(objs[i]);
+    }
+}
+
+/* Alloc/free pairs with the cache already populated */
+static void slab_churn(void) {
+    for (int i = 0; i < SLAB_OBJS; i++) {
+        kfree(kmalloc(64));
+    }
+}
+
+/* ---- printf ---- */
+static void fmt_record(void) {
+    for (uint32_t i = 0; i < FMT_LINES; i++) {
+        lib_sprintf(fmt_buf, "meminfo.slab name=%s obj_size=%u slabs=%u active=%u "
+                    "cached=%u total=%u\n", "kmalloc-64", 64, i, i * 63, i & 15, i * 64);
+    }
+}
+
+static void fmt_hex(void) {
+    for (uint32_t i = 0; i < FMT_LINES; i++) {
+        lib_sprintf(fmt_buf, "%08x %08x %x\n", i * 0x9E3779B9, i, i << 12);
+    }
+}
+
+static void fmt_u64(void) {
+    uint64_t tsc = 0x0123456789ABCDEFULL;
+    for (uint32_t i = 0; i < FMT_LINES; i++) {
+        lib_snprintf(fmt_buf, sizeof(fmt_buf), "[%llu] cycles=%llu\n", tsc + i, tsc >> (i & 31));
+    }
+}
+
+/* ---- RAMDisk ---- */
+static void fs_fresh(void) {
+    fs_init();
+}
+
+static void fs_full(void) {
+    fs_init();
+    for (int i = 0; i < FS_FILES; i++) {
+        fs_write_file(fs_names[i], fs_data, 64);
+    }
+}
+
+static void fs_write_all(void) {
+    for (int i = 0; i < FS_FILES; i++) {
+        fs_write_file(fs_names[i], fs_data, sizeof(fs_data));
+    }
+}
+
+static void fs_append_all(void) {
+    for (int i = 0; i < FS_FILES; i++) {
+        fs_append_file(fs_names[i], fs_data, 64);
+    }
+}
+
+static void fs_find_hit(void) {
+    for (int i = 0; i < FS_FILES; i++) {
+        fs_find_file(fs_names[i]);
+    }
+}
+
+static void fs_find_miss(void) {
+    for (int i = 0; i < FS_FILES; i++) {
+        fs_find_file("bench.missing");
+    }
+}
+
+typedef struct {
+    const char* name;
+    void (*setup)(void);    /* untimed, before every repetition */
+    void (*run)(void);      /* timed */
+    uint32_t units;         /* work per repetition */
+    const char* unit;
+} bench_t;
+
+static const bench_t benches[] = {
+    { "memcpy/kernel.c/4K",   NULL, copy_kernel_4k, SMALL, "B" },
+    { "memcpy/string.c/4K",   NULL, copy_lib_4k,    SMALL, "B" },
+    { "memcpy/libc/4K",       NULL, copy_libc_4k,   SMALL, "B" },
+    { "memcpy/kernel.c/1M",   NULL, copy_kernel_1m, BIG,   "B" },
+    { "memcpy/string.c/1M",   NULL, copy_lib_1m,    BIG,   "B" },
+    { "memcpy/libc/1M",       NULL, copy_libc_1m,   BIG,   "B" },
+    { "memcpy/string.c/1M-unaligned", NULL, copy_lib_unaligned_1m, BIG - 2, "B" },
+    { "memmove/string.c/1M",  NULL, move_lib_1m,    BIG - 64, "B" },
+    { "memset/kernel.c/1M",   NULL, fill_kernel_1m, BIG,   "B" },
+    { "memset/string.c/1M",   NULL, fill_lib_1m,    BIG,   "B" },
+    { "memset/libc/1M",       NULL, fill_libc_1m,   BIG,   "B" },
+    { "memsetl/string.c/1M",  NULL, fill32_lib_1m,  BIG,   "B" },
+    { "memblendl/string.c/1M", NULL, blend_lib_1m,  BIG,   "B" },
+    { "pmm/init-1G",          NULL, pmm_init_1g,    1,     "op" },
+    { "pmm/alloc_page-fill",  pmm_fresh, pmm_fill,  PMM_PAGES, "op" },
+    { "pmm/free_page",        pmm_fresh_filled, pmm_free_all, PMM_PAGES, "op" },
+    { "pmm/alloc_pages-16",   pmm_fresh, pmm_contig, 256,  "op" },
+    { "pmm/churn-half-full",  pmm_half_full, pmm_churn, 4096, "op" },
+    { "pmm/alloc_zeroed-pool",   zero_fresh_pooled, zero_alloc, ZERO_PAGES, "op" },
+    { "pmm/alloc_zeroed-demand", zero_fresh, zero_alloc, ZERO_PAGES, "op" },
+    { "slab/kmalloc-64",      slab_fresh, slab_fill, SLAB_OBJS, "op" },
+    { "slab/kfree-64",        slab_fresh_filled, slab_free_all, SLAB_OBJS, "op" },
+    { "slab/churn-64",        slab_fresh_filled, slab_churn, SLAB_OBJS, "op" },
+    { "slab/mixed-sizes",     slab_fresh, slab_mixed, SLAB_OBJS * 2, "op" },
+    { "printf/sprintf-record", NULL, fmt_record,    FMT_LINES, "op" },
+    { "printf/sprintf-hex",   NULL, fmt_hex,       FMT_LINES, "op" },
+    { "printf/snprintf-u64",  NULL, fmt_u64,       FMT_LINES, "op" },
+    { "fs/write_file-512",    fs_fresh, fs_write_all,  FS_FILES, "op" },
+    { "fs/append_file-64",    fs_full,  fs_append_all, FS_FILES, "op" },
+    { "fs/find_file-hit",     fs_full,  fs_find_hit,   FS_FILES, "op" },
+    { "fs/find_file-miss",    fs_full,  fs_find_miss,  FS_FILES, "op" },
+};
+
+static int cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char** argv) {
+    int reps = DEFAULT_REPS;
+    const char* filter = NULL;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+        } else {
+            filter = argv[i];
+        }
+    }
+    if (reps < 1) {
+        fprintf(stderr, "hostbench: bad repetition count\n");
+        return 1;
+    }
+    
+    cpu_init();
+    string_init();
+    buf_src = aligned_alloc(4096, BIG + 4096);
+    buf_dst = aligned_alloc(4096, BIG + 4096);
+    uint64_t* samples = malloc(sizeof(uint64_t) * reps);
+    slab_window = map_slab_window();
+    if (!buf_src || !buf_dst || !samples || !slab_window) {
+        fprintf(stderr, "hostbench: out of memory\n");
+        return 1;
+    }
+    for (int i = 0; i < BIG + 4096; i++) {
+        buf_src[i] = (uint8_t)(i * 7);
+    }
+    memset(buf_dst, 0, BIG + 4096);
+    for (int i = 0; i < FS_FILES; i++) {
+        snprintf(fs_names[i], sizeof(fs_names[i]), "bench/file%02d.txt", i);
+    }
+    memset(fs_data, 'x', sizeof(fs_data));
+    fs_full();
+    for (int i = 0; i < FS_FILES; i++) {
+        if (fs_find_file(fs_names[i]) < 0) {
+            fprintf(stderr, "hostbench: RAMDisk has no room for %d files\n", FS_FILES);
+            return 1;
+        }
+    }
+    
+    printf("%-30s %12s %12s %12s %10s\n", "test", "min", "median", "max", "cyc/unit");
+    for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+        const bench_t* bench = &benches[b];
+        if (filter && !strstr(bench->name, filter)) {
+            continue;
+        }
+        for (int i = 0; i < WARMUP + reps; i++) {
+            if (bench->setup) {
+                bench->setup();
+            }
+            uint64_t t0 = cycles();
+            bench->run();
+            uint64_t t = cycles() - t0;
+            if (i >= WARMUP) {
+                samples[i - WARMUP] = t;
+            }
+        }
+        qsort(samples, reps, sizeof(uint64_t), cmp_u64);
+        uint64_t med = samples[reps / 2];
+        printf("%-30s %12llu %12llu %12llu %10.2f cyc/%s\n", bench->name,
+               (unsigned long long)samples[0], (unsigned long long)med,
+               (unsigned long long)samples[reps - 1],
+               (double)med / bench->units, bench->unit);
+    }
+    
+    free(samples);
+    free(buf_src);
+    free(buf_dst);
+    return 0;
+}
@@ -0,0 +1,70 @@
+/**
+ * TarkOS - Hosted Benchmark: Simulated Memory Map
+ * Builds the multiboot memory map that pmm_init() sees when the kernel
+ * libraries run as a Linux program. _kernel_start/_kernel_end are defined
+ * by the Makefile at link time (1MB..2MB, like the real kernel image).
+ */
+
+#include <kernel/multiboot.h>
+#include <kernel/pmm.h>
+
+/* Static storage keeps every address below 4GB (hostbench links with -no-pie) */
+static multiboot_mmap_entry_t sim_mmap[3];
+static multiboot_info_t sim_mboot;
+
+/**
+ * Reset the PMM to a fresh machine with mem_mb megabytes of RAM:
+ * low memory, the VGA/BIOS hole, then one large available region
+ */
+void hostbench_pmm_reset(uint32_t mem_mb) {
+    uint32_t top = mem_mb * 1024 * 1024;
+    
+    sim_mmap[0].size = sizeof(multiboot_mmap_entry_t) - sizeof(uint32_t);
+    sim_mmap[0].addr = 0;
+    sim_mmap[0].len = 0x9FC00;
+    sim_mmap[0].type = MULTIBOOT_MEMORY_AVAILABLE;
+    
+    sim_mmap[1].size = sim_mmap[0].size;
+    sim_mmap[1].addr = 0x9FC00;
+    sim_mmap[1].len = 0x100000 - 0x9FC00;
+    sim_mmap[1].type = MULTIBOOT_MEMORY_RESERVED;
+    
+    sim_mmap[2].size = sim_mmap[0].size;
+    sim_mmap[2].addr = 0x100000;
+    sim_mmap[2].len = top - 0x100000;
+    sim_mmap[2].type = MULTIBOOT_MEMORY_AVAILABLE;
+    
+    sim_mboot.flags = MULTIBOOT_INFO_MEMORY | MULTIBOOT_INFO_MEM_MAP;
+    sim_mboot.mem_lower = 639;
+    sim_mboot.mem_upper = (top - 0x100000) / 1024;
+    sim_mboot.mmap_addr = (uint32_t)(unsigned long)sim_mmap;
+    sim_mboot.mmap_length = sizeof(sim_mmap);
+    
+    pmm_init(&sim_mboot);
+}
+
+/**
+ * Reset the PMM with only [base, base + size) free, for allocators that
+ * write to the pages they get (the caller backs that window at its
+ * pmm_to_virt() address in the hostbench process)
+ */
+void hostbench_pmm_window(uint32_t base, uint32_t size) {
+    hostbench_pmm_reset(1024);
+    pmm_mark_region_used(0, base);
+    pmm_mark_region_used(base + size, (uint32_t)pmm_get_total_memory() - (base + size));
+}
+
+/**
+ * Direct-map address of a low-memory frame (pmm_to_virt), for hostbench.c,
+ * which does not include the kernel headers
+ */
+void* hostbench_pmm_virt(uint32_t addr) {
+    return pmm_to_virt(addr);
+}
+
+/**
+ * End of low memory, the part the uint32_t PMM calls allocate from
+ */
+uint32_t hostbench_low_memory_end(void) {
+    return LOW_MEMORY_PAGES * PAGE_SIZE;
+}
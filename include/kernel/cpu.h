@@ -0,0 +1,80 @@
+/**
+ * TarkOS - CPU Identification
+ * CPUID vendor, model and feature detection, run once at boot
+ */
+
+#ifndef _KERNEL_CPU_H
+#define _KERNEL_CPU_H
+
+#include <kernel/types.h>
+
+/* Feature flags (cpu_has, cpu_info_t.features) */
+#define CPU_FPU             (1 << 0)
+#define CPU_TSC             (1 << 1)
+#define CPU_PSE             (1 << 2)    /* 4MB pages */
+#define CPU_PAE             (1 << 3)
+#define CPU_APIC            (1 << 4)    /* On-chip local APIC */
+#define CPU_MTRR            (1 << 5)
+#define CPU_PGE             (1 << 6)    /* Global pages */
+#define CPU_PAT             (1 << 7)
+#define CPU_FXSR            (1 << 8)    /* FXSAVE/FXRSTOR */
+#define CPU_SSE             (1 << 9)
+#define CPU_SSE2            (1 << 10)
+#define CPU_SSE3            (1 << 11)
+#define CPU_SSSE3           (1 << 12)
+#define CPU_SSE4_1          (1 << 13)
+#define CPU_SSE4_2          (1 << 14)
+#define CPU_XSAVE           (1 << 15)
+#define CPU_AVX             (1 << 16)   /* Only set when the OS enabled AVX state (XCR0) */
+#define CPU_AVX2            (1 << 17)   /* Same XCR0 requirement */
+#define CPU_ERMS            (1 << 18)   /* Fast rep movsb/stosb */
+#define CPU_INVARIANT_TSC   (1 << 19)   /* TSC rate survives P- and C-states */
+#define CPU_FEATURE_COUNT   20
+
+/**
+ * CPU identification
+ */
+typedef struct cpu_info {
+    char vendor[13];            /* "GenuineIntel", "AuthenticAMD", ... */
+    char brand[49];             /* Brand string, empty if not reported */
+    uint32_t family;            /* Extended family folded in */
+    uint32_t model;             /* Extended model folded in */
+    uint32_t stepping;
+    uint32_t phys_bits;         /* Physical address width (36 if not reported) */
+    uint32_t features;          /* CPU_* flags */
+} cpu_info_t;
+
+/**
+ * Execute CPUID
+ */
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t* a, uint32_t* b,
+                         uint32_t* c, uint32_t* d) {
+    __asm__ volatile("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d)
+                     : "a"(leaf), "c"(subleaf));
+}
+
+/**
+ * Identify the CPU
+ * Call first thing at boot; cpu_has() reports nothing before it
+ */
+void cpu_init(void);
+
+/**
+ * Get the CPU identification filled in by cpu_init()
+ */
+const cpu_info_t* cpu_get_info(void);
+
+/**
+ * Check for features
+ * @param features One or more CPU_* flags
+ * @return true if the CPU has all of them
+ */
+bool cpu_has(uint32_t features);
+
+/**
+ * Get the name of a feature ("sse2", "erms", ...)
+ * @param index Bit number, 0 to CPU_FEATURE_COUNT - 1
+ */
+const char* cpu_feature_name(uint32_t index);
+
+#endif /* _KERNEL_CPU_H */
@@ -0,0 +1,67 @@
+/**
+ * TarkOS - FPU/SSE Support
+ * x87/SSE setup and lazy FXSAVE/FXRSTOR context switching
+ */
+
+#ifndef _KERNEL_FPU_H
+#define _KERNEL_FPU_H
+
+#include <kernel/types.h>
+
+/* FXSAVE image size (FNSAVE, used without FXSR, needs 108 bytes) */
+#define FPU_STATE_SIZE      512
+
+/**
+ * Saved x87/MMX/SSE registers of one context
+ */
+typedef struct fpu_state {
+    uint8_t data[FPU_STATE_SIZE];
+} __attribute__((aligned(16))) fpu_state_t;
+
+/**
+ * Enable the x87 unit and, if present, SSE (CR0.MP/NE, CR4.OSFXSR/OSXMMEXCPT)
+ * and install the #NM handler. Call after cpu_init() and idt_init(), and
+ * before string_init()
+ */
+void fpu_init(void);
+
+/**
+ * Set a context's state to the power-on defaults (FNINIT, MXCSR 0x1F80)
+ */
+void fpu_state_init(fpu_state_t* state);
+
+/**
+ * Switch FPU contexts (call from the context switch)
+ * Nothing is saved or loaded here: CR0.TS is set, and the first FPU or
+ * SSE instruction of the new context traps to #NM, which saves the old
+ * registers and loads the new ones. Contexts that never use them pay
+ * nothing
+ * @param next State of the context being switched to, or NULL for one
+ *             that only uses the FPU between fpu_begin() and fpu_end()
+ */
+void fpu_switch(fpu_state_t* next);
+
+#ifdef TARKOS_HOSTED
+/* Hosted builds run under an OS that already manages the FPU */
+static inline uint32_t fpu_begin(void) {
+    return 0;
+}
+
+static inline void fpu_end(uint32_t flags) {
+    UNUSED(flags);
+}
+#else
+/**
+ * Start using SSE registers in kernel code (any context, interrupts too)
+ * Disables interrupts and saves whichever context's registers are live
+ * @return Saved EFLAGS for fpu_end()
+ */
+uint32_t fpu_begin(void);
+
+/**
+ * End an fpu_begin() section; the registers are scratch again
+ */
+void fpu_end(uint32_t flags);
+#endif
+
+#endif /* _KERNEL_FPU_H */
@@ -45,8 +45,11 @@ typedef struct {
 
 /**
  * Initialize the framebuffer
+ * Maps it at PAGE_FB_VIRT, so call after paging_init(). Calling it again
+ * after a mode change remaps it and reallocates the back buffer
  * @param mboot Multiboot information (contains framebuffer info)
- * @return true if framebuffer initialized successfully
+ * @return true if framebuffer initialized successfully; on false the
+ *         back buffer is freed and drawing does nothing
  */
 bool fb_init(multiboot_info_t* mboot);
 
@@ -105,8 +108,11 @@ uint32_t* fb_get_back_buffer(void);
 
 /**
  * Enable/disable double buffering
+ * The back buffer (pitch * height bytes) is allocated from the PMM on
+ * enable and returned on disable
+ * @return true if double buffering is now on (false if no memory was left)
  */
-void fb_set_double_buffer(bool enable);
+bool fb_set_double_buffer(bool enable);
 
 /**
  * Check if double buffering is enabled
@@ -45,6 +45,10 @@ static const char* const exception_names[] = {
     "Reserved"
 };
 
+/* CPU exception vectors with handlers */
+#define EXC_NO_FPU      7       /* #NM: FPU/SSE use with CR0.TS set */
+#define EXC_PAGE_FAULT  14
+
 /* IRQ numbers (after remapping) */
 #define IRQ0    32      /* Timer */
 #define IRQ1    33      /* Keyboard */
@@ -68,4 +72,10 @@ static const char* const exception_names[] = {
  */
 void isr_handler(registers_t* regs);
 
+/**
+ * Halt on a CPU exception that no handler could resolve
+ * Exception handlers call this when they cannot recover
+ */
+void isr_panic(registers_t* regs);
+
 #endif /* _KERNEL_ISR_H */
@@ -0,0 +1,32 @@
+/**
+ * TarkOS - Memory Report
+ * PMM, zone, fragmentation, slab and page table statistics
+ */
+
+#ifndef _KERNEL_MEMINFO_H
+#define _KERNEL_MEMINFO_H
+
+#include <kernel/types.h>
+
+/* Output sink, called once per line (newline included) */
+typedef void (*meminfo_write_t)(const char* line);
+
+/**
+ * Write the memory report as a readable table (the meminfo command)
+ */
+void meminfo_print(meminfo_write_t write);
+
+/**
+ * Write the memory report as records for collectors
+ * Each line is a record type ("meminfo", "meminfo.zone", "meminfo.order",
+ * "meminfo.slab") followed by space-separated key=value pairs
+ */
+void meminfo_print_raw(meminfo_write_t write);
+
+/**
+ * Write the record form of the report to COM1
+ * serial_init() must have run
+ */
+void meminfo_report_serial(void);
+
+#endif /* _KERNEL_MEMINFO_H */
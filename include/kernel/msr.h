@@ -0,0 +1,43 @@
+/**
+ * TarkOS - Model-Specific Registers
+ * RDMSR/WRMSR access and the MSR numbers the kernel uses
+ */
+
+#ifndef _KERNEL_MSR_H
+#define _KERNEL_MSR_H
+
+#include <kernel/types.h>
+
+/* Memory type MSRs */
+#define MSR_MTRR_CAP            0x0FE   /* Variable MTRR count, WC support */
+#define MSR_MTRR_PHYSBASE(n)    (0x200 + 2 * (n))
+#define MSR_MTRR_PHYSMASK(n)    (0x201 + 2 * (n))
+#define MSR_PAT                 0x277
+#define MSR_MTRR_DEF_TYPE       0x2FF
+
+/* Memory types (PAT entries and MTRRs) */
+#define MEM_TYPE_UC             0x00    /* Uncacheable */
+#define MEM_TYPE_WC             0x01    /* Write-combining */
+#define MEM_TYPE_WT             0x04    /* Write-through */
+#define MEM_TYPE_WP             0x05    /* Write-protected */
+#define MEM_TYPE_WB             0x06    /* Write-back */
+#define MEM_TYPE_UC_MINUS       0x07    /* Uncached, MTRR may override to WC */
+
+/**
+ * Read a 64-bit MSR
+ */
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/**
+ * Write a 64-bit MSR
+ */
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value),
+                     "d"((uint32_t)(value >> 32)));
+}
+
+#endif /* _KERNEL_MSR_H */
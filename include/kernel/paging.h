@@ -1,37 +1,141 @@
 /**
  * TarkOS - Paging
  * x86 virtual memory management
+ * Two-level 32-bit paging, or PAE when built with -DTARKOS_PAE
  */
 
 #ifndef _KERNEL_PAGING_H
 #define _KERNEL_PAGING_H
 
 #include <kernel/types.h>
+#include <kernel/pmm.h>
 
 /* Page directory/table entry flags */
 #define PAGE_PRESENT        (1 << 0)    /* Page is present in memory */
 #define PAGE_WRITE          (1 << 1)    /* Page is writable */
 #define PAGE_USER           (1 << 2)    /* Page is user-accessible */
-#define PAGE_WRITETHROUGH   (1 << 3)    /* Write-through caching */
+#define PAGE_WRITETHROUGH   (1 << 3)    /* Write-through caching (PAT index bit 0) */
 #define PAGE_NOCACHE        (1 << 4)    /* Disable caching */
 #define PAGE_ACCESSED       (1 << 5)    /* Page has been accessed */
 #define PAGE_DIRTY          (1 << 6)    /* Page has been written to */
-#define PAGE_SIZE_4MB       (1 << 7)    /* 4MB page (in page directory) */
+#define PAGE_SIZE_4MB       (1 << 7)    /* 4MB page (2MB with PAE; in page directory) */
 #define PAGE_GLOBAL         (1 << 8)    /* Global page */
+#define PAGE_PAT            (1 << 7)    /* PAT index bit 2 (in page table entries) */
+#define PAGE_LARGE_PAT      (1 << 12)   /* PAT index bit 2 (in large page entries) */
 
+/*
+ * Write-combining: paging_init programs PAT entry 4 as WC, which the PAT bit
+ * alone selects, so PWT/PCD mappings keep their usual types. paging_map_range
+ * moves it to PAGE_LARGE_PAT in large pages. Dropped on CPUs without a PAT
+ */
+#define PAGE_WC             PAGE_PAT
+
+/*
+ * Software bits (ignored by the CPU) marking demand-zero pages from
+ * paging_reserve: the page belongs to a reserved range, and writes to it
+ * are allowed once it has its own frame
+ */
+#define PAGE_DEMAND         (1 << 9)
+#define PAGE_DEMAND_WRITE   (1 << 10)
+
+/* Page fault error code bits */
+#define PF_PRESENT          (1 << 0)    /* Protection violation, not a missing page */
+#define PF_WRITE            (1 << 1)    /* Fault was a write */
+#define PF_USER             (1 << 2)    /* Fault happened in user mode */
+
+#ifdef TARKOS_PAE
+/*
+ * PAE: 64-bit entries, 512 to a table, and CR3 pointing at a table of four
+ * page directory pointers. The four page directories are contiguous, so
+ * they are indexed as one 2048-entry directory (PAGE_DIR_INDEX is bits 21-31)
+ */
+#define PAGE_DIR_ENTRIES    2048
+#define PAGE_TABLE_ENTRIES  512
+#define PAGE_DIR_SHIFT      21
+#define PAGE_DIR_PAGES      4
+
+/* Address masks */
+#define PAGE_FRAME_MASK     0x000FFFFFFFFFF000ULL
+#define PAGE_LARGE_FRAME_MASK 0x000FFFFFFFE00000ULL
+
+/* 2MB large page size */
+#define PAGE_LARGE_SIZE     0x200000
+
+/* The last four directory entries map the four directories */
+#define PAGE_RECURSIVE_INDEX 2044
+#define PAGE_TABLES_VIRT    0xFF800000
+#define PAGE_DIRECTORY_VIRT 0xFFFFC000
+#else
 /* Page directory and table sizes */
 #define PAGE_DIR_ENTRIES    1024
 #define PAGE_TABLE_ENTRIES  1024
+#define PAGE_DIR_SHIFT      22
+#define PAGE_DIR_PAGES      1
 
 /* Address masks */
 #define PAGE_FRAME_MASK     0xFFFFF000
+#define PAGE_LARGE_FRAME_MASK 0xFFC00000
+
+/* 4MB page size (PSE) */
+#define PAGE_LARGE_SIZE     0x400000
+
+/* The last directory entry maps the directory */
+#define PAGE_RECURSIVE_INDEX 1023
+#define PAGE_TABLES_VIRT    0xFFC00000
+#define PAGE_DIRECTORY_VIRT 0xFFFFF000
+#endif
+
 #define PAGE_FLAGS_MASK     0x00000FFF
 
+/* CR4 bits */
+#define CR4_PSE             (1 << 4)    /* 4MB pages */
+#define CR4_PAE             (1 << 5)    /* 64-bit entries, 3-level tables */
+#define CR4_PGE             (1 << 7)    /* Global pages survive CR3 reloads */
+
+/*
+ * Higher half: the first KERNEL_WINDOW_SIZE bytes of physical memory (kernel
+ * image included) are mapped at KERNEL_VIRTUAL_BASE as well as at 0. The
+ * direct map continues the higher-half mapping over the rest of low memory
+ */
+#define KERNEL_VIRTUAL_BASE 0xC0000000
+#define KERNEL_WINDOW_SIZE  0x01000000
+#define DIRECT_MAP_SIZE     ((uint32_t)LOW_MEMORY_PAGES * PAGE_SIZE)
+
+#if DIRECT_MAP_BASE != KERNEL_VIRTUAL_BASE
+#error "The direct map (pmm_to_virt) must start at KERNEL_VIRTUAL_BASE"
+#endif
+#define PHYS_TO_VIRT(addr)  ((void*)((uint32_t)(addr) + KERNEL_VIRTUAL_BASE))
+#define VIRT_TO_PHYS(addr)  ((uint32_t)(addr) - KERNEL_VIRTUAL_BASE)
+
+/*
+ * Recursive mapping: the directory maps itself from PAGE_RECURSIVE_INDEX on,
+ * so the page table for directory entry i is at PAGE_TABLES_VIRT + i * PAGE_SIZE
+ * and the directory itself at PAGE_DIRECTORY_VIRT
+ */
+
+/* Scratch page (below the recursive window) for editing unmapped frames */
+#define PAGE_SCRATCH_VIRT   (PAGE_TABLES_VIRT - PAGE_SIZE)
+
+/* Temporary kernel mappings (paging_kmap), just below the scratch page */
+#define PAGING_KMAP_SLOTS   16
+#define PAGE_KMAP_VIRT      (PAGE_SCRATCH_VIRT - PAGING_KMAP_SLOTS * PAGE_SIZE)
+
+/* Framebuffer window (paging_map_framebuffer): after the direct map, up to the scratch page's table */
+#define PAGE_FB_VIRT        (KERNEL_VIRTUAL_BASE + DIRECT_MAP_SIZE)
+#define PAGE_FB_END         ((uint32_t)PAGE_DIR_INDEX(PAGE_SCRATCH_VIRT) << PAGE_DIR_SHIFT)
+
+/* paging_map_range flushes entries one by one up to this many, else flushes the whole TLB */
+#define PAGING_FLUSH_THRESHOLD  32
+
 /* Get page directory/table index from virtual address */
-#define PAGE_DIR_INDEX(addr)    (((uint32_t)(addr) >> 22) & 0x3FF)
-#define PAGE_TABLE_INDEX(addr)  (((uint32_t)(addr) >> 12) & 0x3FF)
+#define PAGE_DIR_INDEX(addr)    ((uint32_t)(addr) >> PAGE_DIR_SHIFT)
+#define PAGE_TABLE_INDEX(addr)  (((uint32_t)(addr) >> 12) & (PAGE_TABLE_ENTRIES - 1))
 #define PAGE_OFFSET(addr)       ((uint32_t)(addr) & 0xFFF)
 
+#ifdef TARKOS_PAE
+typedef uint64_t page_dir_entry_t;
+typedef uint64_t page_table_entry_t;
+#else
 /**
  * Page directory entry
  */
@@ -41,16 +145,17 @@ typedef uint32_t page_dir_entry_t;
  * Page table entry
  */
 typedef uint32_t page_table_entry_t;
+#endif
 
 /**
- * Page directory (contains 1024 entries)
+ * Page directory (PAGE_DIR_ENTRIES entries)
  */
 typedef struct page_directory {
     page_dir_entry_t entries[PAGE_DIR_ENTRIES];
 } page_directory_t;
 
 /**
- * Page table (contains 1024 entries)
+ * Page table (PAGE_TABLE_ENTRIES entries)
  */
 typedef struct page_table {
     page_table_entry_t entries[PAGE_TABLE_ENTRIES];
@@ -58,10 +163,24 @@ typedef struct page_table {
 
 /**
  * Initialize paging
- * Sets up identity mapping for kernel and framebuffer
+ * Maps the kernel window at 0 and at KERNEL_VIRTUAL_BASE, the usable ranges
+ * of the rest of low memory after it (the direct map, see LOW_MEMORY_PAGES)
+ * and the recursive directory entry. Kernel window and direct map mappings
+ * are global when the CPU supports it.
+ * Call with interrupts disabled, after cpu_init() and pmm_init(), and before
+ * anything uses pmm_to_virt() (slab_init(), fb_init())
  */
 void paging_init(void);
 
+/**
+ * Map a linear framebuffer write-combining at PAGE_FB_VIRT
+ * Called again on a mode change, replacing the previous mapping
+ * @param phys Physical address of the framebuffer
+ * @param size Size in bytes
+ * @return Its virtual address, or NULL if it does not fit the window
+ */
+void* paging_map_framebuffer(uint32_t phys, uint32_t size);
+
 /**
  * Map a virtual address to a physical address
  * @param virt Virtual address
@@ -70,6 +189,42 @@ void paging_init(void);
  */
 void paging_map(uint32_t virt, uint32_t phys, uint32_t flags);
 
+/**
+ * Map a range of addresses, using 4MB pages where virt and phys allow it
+ * The TLB is flushed once for the whole range
+ * @param virt Virtual start address
+ * @param phys Physical start address
+ * @param size Size in bytes
+ * @param flags Page flags (PAGE_SIZE_4MB is added where a large page is used)
+ */
+void paging_map_range(uint32_t virt, uint32_t phys, uint32_t size, uint32_t flags);
+
+/**
+ * Reserve a demand-zero range: no memory is used until a page is touched
+ * A read maps the shared zero page read-only; the first write gets a
+ * zeroed frame of its own
+ * @param virt Virtual start address
+ * @param size Size in bytes
+ * @param flags Page flags for the populated pages (PAGE_PRESENT is implied)
+ * @return false if a page table could not be allocated
+ */
+bool paging_reserve(uint32_t virt, uint32_t size, uint32_t flags);
+
+/**
+ * Unmap a range from paging_reserve and free the frames it populated
+ * @param virt Virtual start address
+ * @param size Size in bytes
+ */
+void paging_release(uint32_t virt, uint32_t size);
+
+/**
+ * Resolve a page fault in a demand-zero range
+ * @param virt Faulting address (CR2)
+ * @param error Page fault error code (PF_*)
+ * @return false if the fault is not a demand-zero fault or memory ran out
+ */
+bool paging_handle_fault(uint32_t virt, uint32_t error);
+
 /**
  * Unmap a virtual address
  * @param virt Virtual address to unmap
@@ -81,7 +236,22 @@ void paging_unmap(uint32_t virt);
  * @param virt Virtual address
  * @return Physical address, or 0 if not mapped
  */
-uint32_t paging_get_physical(uint32_t virt);
+phys_addr_t paging_get_physical(uint32_t virt);
+
+/**
+ * Map a physical page at a free temporary kernel slot
+ * With PAE this reaches pages above 4GB (from pmm_alloc_page64)
+ * @param phys Physical address of the page
+ * @return Its virtual address, or NULL if every slot is taken or the page
+ *         is above 4GB without PAE
+ */
+void* paging_kmap(phys_addr_t phys);
+
+/**
+ * Release a slot from paging_kmap
+ * @param addr Address paging_kmap returned
+ */
+void paging_kunmap(void* addr);
 
 /**
  * Enable paging
@@ -100,10 +270,15 @@ void paging_disable(void);
 void paging_flush_tlb(uint32_t virt);
 
 /**
- * Flush the entire TLB
+ * Flush the entire TLB except global (kernel) pages, as on an address space switch
  */
 void paging_flush_tlb_all(void);
 
+/**
+ * Flush the entire TLB, global pages included
+ */
+void paging_flush_tlb_global(void);
+
 /**
  * Identity map a range of addresses
  * @param start Start address (page-aligned)
@@ -112,4 +287,10 @@ void paging_flush_tlb_all(void);
  */
 void paging_identity_map(uint32_t start, uint32_t size, uint32_t flags);
 
+/**
+ * Get the memory held by paging structures
+ * @return Pages of page directory and page tables, the static ones included
+ */
+uint32_t paging_get_table_pages(void);
+
 #endif /* _KERNEL_PAGING_H */
@@ -0,0 +1,27 @@
+/**
+ * TarkOS - Per-CPU Data
+ * CPU numbering for per-CPU caches
+ */
+
+#ifndef _KERNEL_PERCPU_H
+#define _KERNEL_PERCPU_H
+
+#include <kernel/types.h>
+
+/* Maximum CPUs with their own per-CPU data (QEMU runs with -smp 3) */
+#define MAX_CPUS            4
+
+/* Per-CPU data is padded to this so CPUs never share a cache line */
+#define CACHE_LINE_SIZE     64
+#define CACHE_ALIGNED       __attribute__((aligned(CACHE_LINE_SIZE)))
+
+/**
+ * Index of the running CPU, 0 to MAX_CPUS - 1
+ * Only the boot CPU runs kernel code until the APs are started, so this
+ * is always 0; AP bring-up will read the local APIC ID here
+ */
+static inline uint32_t cpu_id(void) {
+    return 0;
+}
+
+#endif /* _KERNEL_PERCPU_H */
@@ -13,17 +13,86 @@
 #define PAGE_SIZE           4096
 #define PAGE_SHIFT          12
 
-/* Maximum supported physical memory: 1GB (for simplicity) */
-#define MAX_MEMORY          (1024 * 1024 * 1024)
-#define MAX_PAGES           (MAX_MEMORY / PAGE_SIZE)
+/* Physical address, 64-bit so memory above 4GB can be tracked (PAE) */
+typedef uint64_t phys_addr_t;
+
+/*
+ * Maximum supported physical memory: 16GB with PAE, otherwise 4GB, the
+ * most that 32-bit page tables can map (keeps the maps out of bss)
+ */
+#ifdef TARKOS_PAE
+#define MAX_MEMORY          (16ULL * 1024 * 1024 * 1024)
+#else
+#define MAX_MEMORY          (4ULL * 1024 * 1024 * 1024)
+#endif
+#define MAX_PAGES           ((uint32_t)(MAX_MEMORY / PAGE_SIZE))
 #define BITMAP_SIZE         (MAX_PAGES / 32)
 
+/*
+ * Low memory: the first 768MB. paging_init maps its usable ranges into the
+ * kernel half at DIRECT_MAP_BASE (the direct map), so the uint32_t calls
+ * allocate from here and their frames are used through pmm_to_virt().
+ * Pages above are reached with pmm_alloc_page64() and temporary mappings
+ */
+#define LOW_MEMORY_PAGES    0x30000
+#define DIRECT_MAP_BASE     0xC0000000
+
+/* Pages below 16MB, the reach of ISA DMA */
+#define DMA_MEMORY_PAGES    0x1000
+
+/*
+ * Memory zones. Normal allocations use the normal zone before the DMA zone,
+ * and pmm_alloc_page64() uses the high zone before either
+ */
+#define PMM_ZONE_DMA        0   /* Below 16MB: ISA DMA (pmm_alloc_dma_pages) */
+#define PMM_ZONE_NORMAL     1   /* 16MB to 768MB: direct-mapped, PCI/bus-master DMA */
+#define PMM_ZONE_HIGH       2   /* Above 768MB: temporary mappings only (PAE above 4GB) */
+#define PMM_ZONES           3
+
+/**
+ * Zone statistics
+ */
+typedef struct pmm_zone_info {
+    const char* name;
+    phys_addr_t start;          /* First byte of the zone */
+    phys_addr_t end;            /* End of the zone, clipped to installed memory */
+    uint32_t free_pages;        /* Free pages, per-CPU caches included */
+} pmm_zone_info_t;
+
+/* Largest buddy block: 2^10 pages (4MB) */
+#define PMM_MAX_ORDER       10
+
+/* Per-CPU page magazine: capacity, and pages moved per refill/drain */
+#define PMM_MAG_SIZE        32
+#define PMM_MAG_BATCH       16
+
+/* Pre-zeroed pages kept per CPU by the idle loop */
+#define PMM_ZERO_POOL_SIZE  32
+
+/* Usable memory map ranges remembered for paging_init's direct map */
+#define PMM_MAX_RANGES      32
+
 /* Page frame macros */
 #define PAGE_ALIGN_DOWN(addr)   ((addr) & ~(PAGE_SIZE - 1))
 #define PAGE_ALIGN_UP(addr)     (((addr) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
 #define ADDR_TO_PAGE(addr)      ((addr) >> PAGE_SHIFT)
 #define PAGE_TO_ADDR(page)      ((page) << PAGE_SHIFT)
 
+/**
+ * Kernel pointer to a page from the uint32_t calls, in the direct map
+ * Only valid once paging_init has run
+ */
+static inline void* pmm_to_virt(uint32_t addr) {
+    return (void*)(addr + DIRECT_MAP_BASE);
+}
+
+/**
+ * Physical address of a pointer from pmm_to_virt(), for freeing
+ */
+static inline uint32_t pmm_to_phys(const void* ptr) {
+    return (uint32_t)ptr - DIRECT_MAP_BASE;
+}
+
 /**
  * Initialize the physical memory manager
  * @param mboot Multiboot information structure (contains memory map)
@@ -31,18 +100,57 @@
 void pmm_init(multiboot_info_t* mboot);
 
 /**
- * Allocate a single physical page
+ * Allocate a single low-memory page (from this CPU's magazine when it can)
+ * Comes from the normal zone, or the DMA zone once the normal zone is full
  * @return Physical address of allocated page, or 0 on failure
  */
 uint32_t pmm_alloc_page(void);
 
 /**
- * Allocate multiple contiguous physical pages
+ * Allocate a zeroed physical page
+ * Uses a page pre-zeroed by the idle loop when one is available
+ * @return Physical address of allocated page, or 0 on failure
+ */
+uint32_t pmm_alloc_zeroed_page(void);
+
+/**
+ * Idle-time work: zero one free page into this CPU's zero pool
+ * @return true if a page was zeroed, false if the pool is full or memory is out
+ */
+bool pmm_zero_idle(void);
+
+/**
+ * Allocate a physical page anywhere, preferring the high zone
+ * For frames the kernel only touches through temporary mappings
+ * (paging_kmap), which leaves low memory for everything else
+ * @return Physical address of allocated page, or 0 on failure
+ */
+phys_addr_t pmm_alloc_page64(void);
+
+/**
+ * Free a page from pmm_alloc_page64()
+ * @param addr Physical address of page to free
+ */
+void pmm_free_page64(phys_addr_t addr);
+
+/**
+ * Allocate multiple contiguous low-memory pages
+ * Up to 2^PMM_MAX_ORDER pages are served by the buddy allocator in O(log n).
+ * Normal zone first, then the DMA zone; suitable for 32-bit bus-master DMA
  * @param count Number of pages to allocate
  * @return Physical address of first page, or 0 on failure
  */
 uint32_t pmm_alloc_pages(uint32_t count);
 
+/**
+ * Allocate contiguous pages below 16MB for ISA DMA
+ * Up to 16 pages (64KB) come from one aligned buddy block, so the run
+ * never crosses a 64KB boundary
+ * @param count Number of pages to allocate
+ * @return Physical address of first page, or 0 on failure
+ */
+uint32_t pmm_alloc_dma_pages(uint32_t count);
+
 /**
  * Free a physical page
  * @param addr Physical address of page to free
@@ -79,16 +187,57 @@ void pmm_mark_region_free(uint32_t start, uint32_t size);
 /**
  * Get total physical memory in bytes
  */
-uint32_t pmm_get_total_memory(void);
+uint64_t pmm_get_total_memory(void);
 
 /**
  * Get free physical memory in bytes
  */
-uint32_t pmm_get_free_memory(void);
+uint64_t pmm_get_free_memory(void);
 
 /**
  * Get used physical memory in bytes
  */
-uint32_t pmm_get_used_memory(void);
+uint64_t pmm_get_used_memory(void);
+
+/**
+ * Return this CPU's magazine and zero pool pages to the shared allocator
+ */
+void pmm_drain_local(void);
+
+/**
+ * Get the number of free pages held in per-CPU magazines and zero pools
+ */
+uint32_t pmm_get_cached_pages(void);
+
+/**
+ * Get the number of pre-zeroed pages waiting in the zero pools
+ */
+uint32_t pmm_get_zeroed_pages(void);
+
+/**
+ * Get statistics for a zone
+ * @param zone PMM_ZONE_DMA, PMM_ZONE_NORMAL or PMM_ZONE_HIGH
+ * @return false if zone is out of range
+ */
+bool pmm_get_zone_info(uint32_t zone, pmm_zone_info_t* info);
+
+/**
+ * Get a usable range of the boot memory map, whole pages only
+ * @param index Range number, from 0
+ * @return false once index is past the last range
+ */
+bool pmm_get_usable_range(uint32_t index, phys_addr_t* start, phys_addr_t* end);
+
+/**
+ * Get the number of free buddy blocks of each order
+ * @param counts Receives PMM_MAX_ORDER + 1 counts, order 0 first
+ */
+void pmm_get_free_blocks(uint32_t* counts);
+
+/**
+ * Get the longest run of free pages
+ * Pages held in per-CPU caches count as used
+ */
+uint32_t pmm_get_largest_free_run(void);
 
 #endif /* _KERNEL_PMM_H */
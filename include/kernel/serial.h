@@ -0,0 +1,38 @@
+/**
+ * TarkOS - Serial Port Driver
+ * 16550 UART on COM1, polled output
+ */
+
+#ifndef _KERNEL_SERIAL_H
+#define _KERNEL_SERIAL_H
+
+#include <kernel/types.h>
+
+/* COM1 base port and register offsets */
+#define COM1_PORT           0x3F8
+#define SERIAL_DATA         0       /* Data (divisor low byte with DLAB) */
+#define SERIAL_INT_ENABLE   1       /* Interrupt enable (divisor high byte with DLAB) */
+#define SERIAL_FIFO_CTRL    2
+#define SERIAL_LINE_CTRL    3
+#define SERIAL_MODEM_CTRL   4
+#define SERIAL_LINE_STATUS  5
+
+/* Line status flags */
+#define SERIAL_LSR_THRE     0x20    /* Transmit holding register empty */
+
+/**
+ * Initialize COM1: 115200 baud, 8N1, FIFOs on, no interrupts
+ */
+void serial_init(void);
+
+/**
+ * Write a character, waiting for room in the transmitter
+ */
+void serial_putc(char c);
+
+/**
+ * Write a string
+ */
+void serial_write(const char* str);
+
+#endif /* _KERNEL_SERIAL_H */
@@ -0,0 +1,101 @@
+/**
+ * TarkOS - Slab Allocator
+ * Object caches and kmalloc/kfree built on single PMM pages
+ */
+
+#ifndef _KERNEL_SLAB_H
+#define _KERNEL_SLAB_H
+
+#include <kernel/types.h>
+
+/* kmalloc size classes: 16, 32, ... 2048 bytes; larger requests take whole pages */
+#define KMALLOC_MIN_SIZE    16
+#define KMALLOC_MAX_SIZE    2048
+#define KMALLOC_CLASSES     8
+
+/* Maximum number of caches (kmalloc classes included) */
+#define SLAB_MAX_CACHES     32
+
+/* Per-CPU object magazine: capacity, and objects moved per refill/drain */
+#define SLAB_MAG_SIZE       16
+#define SLAB_MAG_BATCH      8
+
+/* Object constructor: runs once per object when its slab is created */
+typedef void (*slab_ctor_t)(void* obj);
+
+typedef struct kmem_cache kmem_cache_t;
+
+/**
+ * Per-cache statistics
+ */
+typedef struct slab_stats {
+    const char* name;
+    uint32_t obj_size;          /* Object size after alignment */
+    uint32_t objs_per_slab;
+    uint32_t slabs;             /* Pages owned by the cache */
+    uint32_t active_objs;       /* Objects handed out */
+    uint32_t cached_objs;       /* Free objects held in per-CPU magazines */
+    uint32_t total_objs;        /* Objects in all slabs */
+    uint32_t allocs;            /* Successful allocations */
+    uint32_t frees;
+    uint32_t failures;          /* Allocations that found no memory */
+} slab_stats_t;
+
+/**
+ * Initialize the slab allocator and the kmalloc caches
+ * The PMM must be initialized first
+ */
+void slab_init(void);
+
+/**
+ * Create an object cache
+ * @param name Name shown in statistics (not copied)
+ * @param size Object size in bytes
+ * @param align Object alignment (power of two, 0 for the default of 8)
+ * @param ctor Constructor, or NULL
+ * @return The cache, or NULL if the size is too large or no slot is left
+ */
+kmem_cache_t* kmem_cache_create(const char* name, uint32_t size, uint32_t align,
+                                slab_ctor_t ctor);
+
+/**
+ * Allocate an object from a cache
+ * @return The object, or NULL when out of memory
+ */
+void* kmem_cache_alloc(kmem_cache_t* cache);
+
+/**
+ * Return an object to its cache
+ * Objects keep their constructed state while they are free
+ */
+void kmem_cache_free(kmem_cache_t* cache, void* obj);
+
+/**
+ * Allocate size bytes from the matching size class (16-byte aligned)
+ * @return The block, or NULL when out of memory
+ */
+void* kmalloc(size_t size);
+
+/**
+ * Free a block from kmalloc (NULL is ignored)
+ */
+void kfree(void* ptr);
+
+/**
+ * Return this CPU's magazine objects to their slabs (all caches)
+ */
+void slab_drain_local(void);
+
+/**
+ * Get statistics for a cache
+ * @param index Cache index, 0 to slab_cache_count() - 1
+ * @return false if index is out of range
+ */
+bool slab_get_stats(uint32_t index, slab_stats_t* stats);
+
+/**
+ * Get the number of caches
+ */
+uint32_t slab_cache_count(void);
+
+#endif /* _KERNEL_SLAB_H */
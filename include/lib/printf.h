@@ -1,6 +1,9 @@
 /**
  * TarkOS - Printf Functions
- * Formatted output for debugging
+ * Formatted output for logs and debugging
+ *
+ * Conversions: %d %i %u %x %X %p %s %c %%, with the '0' and '-' flags,
+ * a field width, and the l, ll (64-bit) and z length modifiers
  */
 
 #ifndef _LIB_PRINTF_H
@@ -22,4 +25,17 @@ int sprintf(char* buf, const char* fmt, ...);
  */
 int vsprintf(char* buf, const char* fmt, __builtin_va_list args);
 
+/**
+ * Format string into a buffer of size bytes (like snprintf)
+ * Output past size - 1 characters is dropped; the result is always
+ * NUL-terminated unless size is 0
+ * @return Length of the full output, which is size or more if it was cut
+ */
+int snprintf(char* buf, size_t size, const char* fmt, ...);
+
+/**
+ * Format string with va_list into a buffer of size bytes
+ */
+int vsnprintf(char* buf, size_t size, const char* fmt, __builtin_va_list args);
+
 #endif /* _LIB_PRINTF_H */
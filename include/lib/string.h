@@ -8,6 +8,13 @@
 
 #include <kernel/types.h>
 
+/**
+ * Select the copy, fill and blend routines for this CPU (ERMS, SSE2)
+ * Call once at boot, after cpu_init() and fpu_init(); until then
+ * memcpy and friends use rep movs/stos only
+ */
+void string_init(void);
+
 /**
  * Copy memory from source to destination
  */
@@ -28,6 +35,12 @@ void* memsetw(void* dest, uint16_t val, size_t n);
  */
 void* memsetl(void* dest, uint32_t val, size_t n);
 
+/**
+ * Alpha-blend n ARGB pixels from src over dest, as gfx_blend_colors() does
+ * for each pixel: alpha 255 copies the source, alpha 0 keeps dest
+ */
+void* memblendl(uint32_t* dest, const uint32_t* src, size_t n);
+
 /**
  * Compare memory regions
  */
@@ -0,0 +1,145 @@
+/**
+ * TarkOS - CPU Identification Implementation
+ * Reads CPUID once at boot; everything else asks cpu_has()
+ */
+
+#include <kernel/cpu.h>
+#include <lib/string.h>
+
+/* CPUID registers that carry feature bits */
+#define REG_1_EDX           0   /* Leaf 1 */
+#define REG_1_ECX           1
+#define REG_7_EBX           2   /* Leaf 7, subleaf 0 */
+#define REG_EXT7_EDX        3   /* Leaf 0x80000007 */
+#define FEATURE_REGS        4
+
+/* CPUID.1:ECX bit set once the OS has enabled XSAVE (CR4.OSXSAVE) */
+#define CPUID_1_ECX_OSXSAVE (1U << 27)
+
+/* XCR0 state components AVX needs: SSE and the upper YMM halves */
+#define XCR0_AVX_STATE      0x6
+
+/**
+ * Where each CPU_* flag lives, in flag order
+ */
+static const struct {
+    const char* name;
+    uint8_t reg;
+    uint8_t bit;
+} cpu_feature_bits[CPU_FEATURE_COUNT] = {
+    { "fpu",    REG_1_EDX, 0 },
+    { "tsc",    REG_1_EDX, 4 },
+    { "pse",    REG_1_EDX, 3 },
+    { "pae",    REG_1_EDX, 6 },
+    { "apic",   REG_1_EDX, 9 },
+    { "mtrr",   REG_1_EDX, 12 },
+    { "pge",    REG_1_EDX, 13 },
+    { "pat",    REG_1_EDX, 16 },
+    { "fxsr",   REG_1_EDX, 24 },
+    { "sse",    REG_1_EDX, 25 },
+    { "sse2",   REG_1_EDX, 26 },
+    { "sse3",   REG_1_ECX, 0 },
+    { "ssse3",  REG_1_ECX, 9 },
+    { "sse4_1", REG_1_ECX, 19 },
+    { "sse4_2", REG_1_ECX, 20 },
+    { "xsave",  REG_1_ECX, 26 },
+    { "avx",    REG_1_ECX, 28 },
+    { "avx2",   REG_7_EBX, 5 },
+    { "erms",   REG_7_EBX, 9 },
+    { "invtsc", REG_EXT7_EDX, 8 },
+};
+
+static cpu_info_t cpu_info;
+
+/**
+ * Identify the CPU
+ */
+void cpu_init(void) {
+    uint32_t regs[FEATURE_REGS] = { 0 };
+    uint32_t max, ext_max, a, b, c, d;
+    
+    memset(&cpu_info, 0, sizeof(cpu_info));
+    
+    /* Vendor: EBX, EDX, ECX */
+    cpuid(0, 0, &max, &b, &c, &d);
+    memcpy(&cpu_info.vendor[0], &b, 4);
+    memcpy(&cpu_info.vendor[4], &d, 4);
+    memcpy(&cpu_info.vendor[8], &c, 4);
+    
+    if (max >= 1) {
+        cpuid(1, 0, &a, &b, &regs[REG_1_ECX], &regs[REG_1_EDX]);
+        cpu_info.stepping = a & 0xF;
+        cpu_info.model = (a >> 4) & 0xF;
+        cpu_info.family = (a >> 8) & 0xF;
+        if (cpu_info.family == 0x6 || cpu_info.family == 0xF) {
+            cpu_info.model |= ((a >> 16) & 0xF) << 4;
+        }
+        if (cpu_info.family == 0xF) {
+            cpu_info.family += (a >> 20) & 0xFF;
+        }
+    }
+    if (max >= 7) {
+        cpuid(7, 0, &a, &regs[REG_7_EBX], &c, &d);
+    }
+    
+    cpuid(0x80000000, 0, &ext_max, &b, &c, &d);
+    if (ext_max >= 0x80000004) {
+        uint32_t brand[12];
+        for (uint32_t leaf = 0; leaf < 3; leaf++) {
+            cpuid(0x80000002 + leaf, 0, &brand[leaf * 4], &brand[leaf * 4 + 1],
+                  &brand[leaf * 4 + 2], &brand[leaf * 4 + 3]);
+        }
+        memcpy(cpu_info.brand, brand, sizeof(brand));
+        
+        /* Intel pads the brand string on the left */
+        char* start = cpu_info.brand;
+        while (*start == ' ') {
+            start++;
+        }
+        memmove(cpu_info.brand, start, strlen(start) + 1);
+    }
+    if (ext_max >= 0x80000007) {
+        cpuid(0x80000007, 0, &a, &b, &c, &regs[REG_EXT7_EDX]);
+    }
+    cpu_info.phys_bits = 36;
+    if (ext_max >= 0x80000008) {
+        cpuid(0x80000008, 0, &a, &b, &c, &d);
+        cpu_info.phys_bits = a & 0xFF;
+    }
+    
+    for (uint32_t i = 0; i < CPU_FEATURE_COUNT; i++) {
+        if (regs[cpu_feature_bits[i].reg] & (1U << cpu_feature_bits[i].bit)) {
+            cpu_info.features |= 1U << i;
+        }
+    }
+    
+    /* AVX instructions fault unless the OS saves their registers (XCR0) */
+    uint32_t xcr0 = 0;
+    if (regs[REG_1_ECX] & CPUID_1_ECX_OSXSAVE) {
+        __asm__ volatile("xgetbv" : "=a"(xcr0), "=d"(d) : "c"(0));
+    }
+    if ((xcr0 & XCR0_AVX_STATE) != XCR0_AVX_STATE) {
+        cpu_info.features &= ~(CPU_AVX | CPU_AVX2);
+    }
+}
+
+/**
+ * Get the CPU identification
+ */
+const cpu_info_t* cpu_get_info(void) {
+    return &cpu_info;
+}
+
+/**
+ * Check for features
+ */
+bool cpu_has(uint32_t features) {
+    return (cpu_info.features & features) == features;
+}
+
+/**
+ * Get the name of a feature
+ */
+const char* cpu_feature_name(uint32_t index) {
+    return (index < CPU_FEATURE_COUNT) ? cpu_feature_bits[index].name : "";
+}
@@ -0,0 +1,187 @@
+/**
+ * TarkOS - FPU/SSE Support Implementation
+ * The registers belong to one context at a time (fpu_owner). CR0.TS is
+ * set whenever that is not the running context (fpu_current), so the
+ * first FPU instruction after a switch traps and #NM moves the state
+ */
+
+#include <kernel/fpu.h>
+#include <kernel/cpu.h>
+#include <kernel/isr.h>
+#include <lib/string.h>
+
+/* Control register bits */
+#define CR0_MP              (1 << 1)    /* WAIT traps on TS too */
+#define CR0_EM              (1 << 2)    /* Emulate: every FPU instruction traps */
+#define CR0_TS              (1 << 3)    /* Task switched: next FPU use traps */
+#define CR0_NE              (1 << 5)    /* x87 errors as #MF, not IRQ13 */
+#define CR4_OSFXSR          (1 << 9)    /* FXSAVE/FXRSTOR and SSE allowed */
+#define CR4_OSXMMEXCPT      (1 << 10)   /* SSE errors as #XM */
+
+#define EFLAGS_IF           (1 << 9)
+#define MXCSR_DEFAULT       0x1F80      /* All SSE exceptions masked */
+
+static bool fpu_present = false;
+static bool fpu_fxsr = false;
+
+/* Context whose registers are live, and the running context (NULL: none) */
+static fpu_state_t* fpu_owner = NULL;
+static fpu_state_t* fpu_current = NULL;
+
+/* CR0.TS as last written, so CR0 is only touched when it changes */
+static bool fpu_ts = false;
+
+/* Power-on state copied into new contexts */
+static fpu_state_t fpu_clean;
+
+static inline uint32_t read_cr0(void) {
+    uint32_t cr0;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    return cr0;
+}
+
+static inline void write_cr0(uint32_t cr0) {
+    __asm__ volatile("mov %0, %%cr0" : : "r"(cr0) : "memory");
+}
+
+/**
+ * Set or clear CR0.TS
+ */
+static void set_ts(bool ts) {
+    if (ts == fpu_ts) {
+        return;
+    }
+    if (ts) {
+        write_cr0(read_cr0() | CR0_TS);
+    } else {
+        __asm__ volatile("clts" : : : "memory");
+    }
+    fpu_ts = ts;
+}
+
+/**
+ * Save the live registers (FNSAVE also reinitializes the x87 unit)
+ */
+static void fpu_save(fpu_state_t* state) {
+    if (fpu_fxsr) {
+        __asm__ volatile("fxsave %0" : "=m"(*state));
+    } else {
+        __asm__ volatile("fnsave %0" : "=m"(*state));
+    }
+}
+
+/**
+ * Load saved registers
+ */
+static void fpu_restore(const fpu_state_t* state) {
+    if (fpu_fxsr) {
+        __asm__ volatile("fxrstor %0" : : "m"(*state));
+    } else {
+        __asm__ volatile("frstor %0" : : "m"(*state));
+    }
+}
+
+/**
+ * #NM: the running context used the FPU while another one owns it
+ */
+static void fpu_trap_handler(registers_t* regs) {
+    if (fpu_current == NULL) {
+        /* FPU use outside fpu_begin() in a context without state */
+        isr_panic(regs);
+        return;
+    }
+    
+    set_ts(false);
+    if (fpu_owner != NULL) {
+        fpu_save(fpu_owner);
+    }
+    fpu_restore(fpu_current);
+    fpu_owner = fpu_current;
+}
+
+/**
+ * Enable the x87 unit and SSE
+ */
+void fpu_init(void) {
+    uint32_t cr0 = read_cr0();
+    
+    if (!cpu_has(CPU_FPU)) {
+        /* No x87: let every FPU instruction fault */
+        write_cr0((cr0 | CR0_EM) & ~CR0_MP);
+        return;
+    }
+    write_cr0((cr0 | CR0_MP | CR0_NE) & ~(CR0_EM | CR0_TS));
+    fpu_present = true;
+    fpu_ts = false;
+    
+    if (cpu_has(CPU_FXSR)) {
+        uint32_t cr4;
+        __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+        cr4 |= CR4_OSFXSR;
+        if (cpu_has(CPU_SSE)) {
+            cr4 |= CR4_OSXMMEXCPT;
+        }
+        __asm__ volatile("mov %0, %%cr4" : : "r"(cr4));
+        fpu_fxsr = true;
+    }
+    
+    __asm__ volatile("fninit");
+    if (cpu_has(CPU_SSE)) {
+        uint32_t mxcsr = MXCSR_DEFAULT;
+        __asm__ volatile("ldmxcsr %0" : : "m"(mxcsr));
+    }
+    memset(&fpu_clean, 0, sizeof(fpu_clean));
+    fpu_save(&fpu_clean);
+    
+    register_interrupt_handler(EXC_NO_FPU, fpu_trap_handler);
+    
+    /* The boot context has no state; the registers are free */
+    fpu_owner = NULL;
+    fpu_current = NULL;
+}
+
+/**
+ * Set a context's state to the power-on defaults
+ */
+void fpu_state_init(fpu_state_t* state) {
+    memcpy(state, &fpu_clean, sizeof(*state));
+}
+
+/**
+ * Switch FPU contexts lazily
+ */
+void fpu_switch(fpu_state_t* next) {
+    if (!fpu_present) {
+        return;
+    }
+    fpu_current = next;
+    set_ts(fpu_owner != next);
+}
+
+/**
+ * Start a kernel SSE section
+ */
+uint32_t fpu_begin(void) {
+    uint32_t flags;
+    __asm__ volatile("pushfl\n\t"
+                     "popl %0\n\t"
+                     "cli" : "=r"(flags) : : "memory");
+    
+    set_ts(false);
+    if (fpu_owner != NULL) {
+        fpu_save(fpu_owner);
+        fpu_owner = NULL;
+    }
+    return flags;
+}
+
+/**
+ * End a kernel SSE section
+ */
+void fpu_end(uint32_t flags) {
+    /* The owner's registers were saved; its next use reloads them */
+    set_ts(fpu_current != NULL);
+    if (flags & EFLAGS_IF) {
+        STI();
+    }
+}
@@ -10,6 +10,20 @@
 /* External handler getter from idt.c */
 extern isr_handler_t get_interrupt_handler(uint8_t n);
 
+/**
+ * Halt on a CPU exception that no handler could resolve
+ */
+void isr_panic(registers_t* regs) {
+    UNUSED(regs);
+    
+    /* In a full OS, this would trigger a kernel panic */
+    /* For now, just halt */
+    CLI();
+    while (1) {
+        HLT();
+    }
+}
+
 /**
  * Main ISR handler - called from assembly stub
  * Dispatches to registered handlers
@@ -23,12 +37,7 @@ void isr_handler(registers_t* regs) {
         handler(regs);
     } else if (regs->int_no < 32) {
         /* Unhandled CPU exception - this is bad */
-        /* In a full OS, this would trigger a kernel panic */
-        /* For now, just halt */
-        CLI();
-        while (1) {
-            HLT();
-        }
+        isr_panic(regs);
     }
     
     /* Send End of Interrupt (EOI) for hardware interrupts */
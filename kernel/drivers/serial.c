@@ -0,0 +1,39 @@
+/**
+ * TarkOS - Serial Port Driver Implementation
+ * 16550 UART on COM1, polled output
+ */
+
+#include <kernel/serial.h>
+#include <kernel/ports.h>
+
+/**
+ * Initialize COM1
+ */
+void serial_init(void) {
+    outb(COM1_PORT + SERIAL_INT_ENABLE, 0x00);  /* No interrupts */
+    outb(COM1_PORT + SERIAL_LINE_CTRL, 0x80);   /* DLAB on */
+    outb(COM1_PORT + SERIAL_DATA, 0x01);        /* Divisor 1: 115200 baud */
+    outb(COM1_PORT + SERIAL_INT_ENABLE, 0x00);
+    outb(COM1_PORT + SERIAL_LINE_CTRL, 0x03);   /* 8N1, DLAB off */
+    outb(COM1_PORT + SERIAL_FIFO_CTRL, 0xC7);   /* FIFOs on, cleared, 14-byte threshold */
+    outb(COM1_PORT + SERIAL_MODEM_CTRL, 0x0B);  /* DTR, RTS, OUT2 */
+}
+
+/**
+ * Write a character
+ */
+void serial_putc(char c) {
+    while (!(inb(COM1_PORT + SERIAL_LINE_STATUS) & SERIAL_LSR_THRE)) {
+        /* Wait for the transmitter */
+    }
+    outb(COM1_PORT + SERIAL_DATA, (uint8_t)c);
+}
+
+/**
+ * Write a string
+ */
+void serial_write(const char* str) {
+    while (*str) {
+        serial_putc(*str++);
+    }
+}
@@ -7,6 +7,7 @@
 #include <kernel/ports.h>
 #include <kernel/idt.h>
 #include <kernel/isr.h>
+#include <kernel/pmm.h>
 
 /* PIT I/O ports */
 #define PIT_CHANNEL0    0x40
@@ -78,7 +79,10 @@ uint32_t timer_get_uptime_seconds(void) {
 void timer_sleep_ticks(uint32_t ticks) {
     uint32_t end = timer_ticks + ticks;
     while (timer_ticks < end) {
-        HLT();  /* Wait for next interrupt */
+        /* Use idle time to pre-zero pages, then wait for next interrupt */
+        if (!pmm_zero_idle()) {
+            HLT();
+        }
     }
 }
 
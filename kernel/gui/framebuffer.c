@@ -4,43 +4,100 @@
  */
 
 #include <kernel/framebuffer.h>
+#include <kernel/pmm.h>
+#include <kernel/paging.h>
 #include <lib/string.h>
 
 /* Framebuffer info */
 static framebuffer_info_t fb_info;
 
-/* Back buffer for double buffering */
+/* Back buffer for double buffering: PMM pages covering pitch * height, used through the direct map */
 static uint32_t* back_buffer = NULL;
+static uint32_t back_buffer_pages = 0;
 static bool double_buffering = false;
 
 /* Current drawing target */
 static uint32_t* draw_target = NULL;
 
+/**
+ * Allocate a cleared back buffer for the current mode
+ */
+static bool back_buffer_alloc(void) {
+    uint32_t pages = PAGE_ALIGN_UP(fb_info.size) / PAGE_SIZE;
+    uint32_t addr = pmm_alloc_pages(pages);
+    if (addr == 0) {
+        return false;
+    }
+    
+    back_buffer = pmm_to_virt(addr);
+    back_buffer_pages = pages;
+    memset(back_buffer, 0, fb_info.size);
+    return true;
+}
+
+/**
+ * Return the back buffer to the PMM
+ */
+static void back_buffer_release(void) {
+    if (back_buffer != NULL) {
+        pmm_free_pages(pmm_to_phys(back_buffer), back_buffer_pages);
+        back_buffer = NULL;
+        back_buffer_pages = 0;
+    }
+}
+
+/**
+ * Drop the framebuffer: free the back buffer and forget the old mode, so a
+ * failed mode change leaves nothing to draw to
+ */
+static bool fb_disable(void) {
+    back_buffer_release();
+    double_buffering = false;
+    memset(&fb_info, 0, sizeof(fb_info));
+    draw_target = NULL;
+    return false;
+}
+
 /**
  * Initialize the framebuffer
+ * Called after paging_init(), and again on a mode change; the back buffer is
+ * reallocated at the new size. On failure the framebuffer is left disabled
  */
 bool fb_init(multiboot_info_t* mboot) {
     /* Check if framebuffer info is available */
     if (!(mboot->flags & MULTIBOOT_INFO_FRAMEBUFFER_INFO)) {
-        return false;
+        return fb_disable();
     }
     
     /* Check framebuffer type (must be RGB) */
     if (mboot->framebuffer_type != MULTIBOOT_FRAMEBUFFER_TYPE_RGB) {
-        return false;
+        return fb_disable();
     }
     
-    /* Store framebuffer info */
-    fb_info.address = (uint32_t*)(uint32_t)mboot->framebuffer_addr;
+    /* Store framebuffer info, with the framebuffer mapped write-combining */
     fb_info.width = mboot->framebuffer_width;
     fb_info.height = mboot->framebuffer_height;
     fb_info.pitch = mboot->framebuffer_pitch;
     fb_info.bpp = mboot->framebuffer_bpp;
     fb_info.size = fb_info.pitch * fb_info.height;
+    fb_info.address = paging_map_framebuffer((uint32_t)mboot->framebuffer_addr, fb_info.size);
+    if (fb_info.address == NULL) {
+        return fb_disable();
+    }
     
     /* Set initial draw target to framebuffer */
     draw_target = fb_info.address;
     
+    /* Resize the back buffer, or fall back to drawing on the front buffer */
+    if (double_buffering) {
+        back_buffer_release();
+        if (back_buffer_alloc()) {
+            draw_target = back_buffer;
+        } else {
+            double_buffering = false;
+        }
+    }
+    
     return true;
 }
 
@@ -155,18 +212,19 @@ uint32_t* fb_get_back_buffer(void) {
 /**
  * Enable/disable double buffering
  */
-void fb_set_double_buffer(bool enable) {
+bool fb_set_double_buffer(bool enable) {
     if (enable && back_buffer == NULL) {
-        /* Allocate back buffer (use static allocation for now) */
-        /* In a real OS, this would use pmm_alloc_pages() */
-        static uint32_t static_back_buffer[1024 * 768] __attribute__((aligned(4096)));
-        back_buffer = static_back_buffer;
+        if (fb_info.address == NULL || !back_buffer_alloc()) {
+            return false;
+        }
         draw_target = back_buffer;
         double_buffering = true;
     } else if (!enable) {
         draw_target = fb_info.address;
         double_buffering = false;
+        back_buffer_release();
     }
+    return double_buffering;
 }
 
 /**
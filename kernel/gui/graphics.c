@@ -305,19 +305,26 @@ uint32_t gfx_blend_colors(uint32_t fg, uint32_t bg, uint8_t alpha) {
  */
 void gfx_draw_bitmap_alpha(int32_t x, int32_t y, uint32_t width, uint32_t height,
                            const uint32_t* data) {
-    for (uint32_t py = 0; py < height; py++) {
-        for (uint32_t px = 0; px < width; px++) {
-            uint32_t pixel = data[py * width + px];
-            uint8_t alpha = (pixel >> 24) & 0xFF;
-            
-            if (alpha == 255) {
-                fb_put_pixel(x + px, y + py, pixel);
-            } else if (alpha > 0) {
-                uint32_t bg = fb_get_pixel(x + px, y + py);
-                uint32_t blended = gfx_blend_colors(pixel, bg, alpha);
-                fb_put_pixel(x + px, y + py, blended);
-            }
-        }
+    framebuffer_info_t* fb = fb_get_info();
+    uint32_t pitch_pixels = fb->pitch / 4;
+    
+    /* Clip to screen bounds */
+    int32_t x1 = (x < 0) ? 0 : x;
+    int32_t y1 = (y < 0) ? 0 : y;
+    int32_t x2 = x + width;
+    int32_t y2 = y + height;
+    
+    if (x2 > (int32_t)fb->width) x2 = fb->width;
+    if (y2 > (int32_t)fb->height) y2 = fb->height;
+    
+    if (x1 >= x2 || y1 >= y2) return;
+    
+    uint32_t* target = fb_is_double_buffered() ? fb_get_back_buffer() : fb_get_address();
+    
+    /* Blend each visible row in one call (same result as gfx_blend_colors) */
+    for (int32_t py = y1; py < y2; py++) {
+        memblendl(&target[py * pitch_pixels + x1],
+                  &data[(py - y) * width + (x1 - x)], x2 - x1);
     }
 }
 
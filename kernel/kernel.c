@@ -8,6 +8,7 @@
 typedef unsigned char uint8_t;
 typedef unsigned short uint16_t;
 typedef unsigned int uint32_t;
+typedef unsigned long long uint64_t;
 typedef int int32_t;
 typedef int bool;
 #define true 1
@@ -15,6 +16,18 @@ typedef int bool;
 #define NULL ((void *)0)
 
 /* ============= I/O PRIMITIVES ============= */
+#ifdef TARKOS_HOSTED
+// Linux build for host/hostbench: port I/O is a no-op that reports every
+// status bit set, so polling loops (serial, PIT calibration) fall through.
+static inline uint8_t inb(uint16_t port) {
+  (void)port;
+  return 0xFF;
+}
+static inline void outb(uint16_t port, uint8_t v) {
+  (void)port;
+  (void)v;
+}
+#else
 static inline uint8_t inb(uint16_t port) {
   uint8_t r;
   __asm__ volatile("inb %1, %0" : "=a"(r) : "Nd"(port));
@@ -23,12 +36,19 @@ static inline uint8_t inb(uint16_t port) {
 static inline void outb(uint16_t port, uint8_t v) {
   __asm__ volatile("outb %0, %1" : : "a"(v), "Nd"(port));
 }
+#endif
+static inline uint64_t rdtsc() {
+  uint32_t lo, hi;
+  __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  return ((uint64_t)hi << 32) | lo;
+}
 
 /* ============= PROTOTYPES ============= */
 void clear_screen();
 void update_cursor(int x, int y);
 void put_char_raw(char c, uint8_t col, int x, int y);
 void print(const char *s);
+void print_error(const char *s);
 void print_at(int x, int y, const char *s, uint8_t col);
 void shell_loop();
 void tredit(const char *filename);
@@ -49,11 +69,13 @@ void draw_shell_static();
 void draw_shell_dynamic();
 void delay_ms(int ms);
 void cpuid(uint32_t code, uint32_t *a, uint32_t *d);
+void cpu_detect();
 int split_args(char *line, char **argv, int max_args);
 char *after_n_tokens(char *s, int n);
 int calc_eval(const char *expr, int *out);
 int starts_with(const char *s, const char *prefix);
 int str_contains(const char *s, const char *needle);
+int str_has_word(const char *s, const char *word);
 int build_path(const char *name, char *out);
 void path_parent(const char *path, char *out);
 int fs_write_file(const char *name, const char *data, int size);
@@ -70,12 +92,23 @@ int fs_used_files();
 int fs_used_bytes();
 const char *command_desc(const char *cmd);
 int command_runs_without_args(const char *cmd);
+typedef struct stream stream_t;
+void stream_write(stream_t *st, const char *s, int n);
+void shell_exec(int argc, char **argv, char *raw_line);
+void shell_run_line(char *line);
+void serial_put_char(char c);
+void klog(const char *msg);
 
 /* ============= VGA DRIVER v10.0 (ETERNAL) ============= */
 #define VGA_ADDR 0xB8000
 #define VGA_WIDTH 80
 #define VGA_HEIGHT 25
+#ifdef TARKOS_HOSTED
+static uint16_t vga_shadow[VGA_WIDTH * VGA_HEIGHT];
+static uint16_t *vga = vga_shadow;
+#else
 static uint16_t *vga = (uint16_t *)VGA_ADDR;
+#endif
 static uint16_t current_x = 0, current_y = 1;
 
 static uint8_t col_bg = 0x1F;
@@ -276,10 +309,39 @@ void put_char(char c) {
   update_cursor(current_x, current_y);
 }
 
+// Set while a command's output is piped or redirected (see shell_run_line)
+static stream_t *out_stream = NULL;
+
 void print(const char *s) {
+  if (out_stream) {
+    stream_write(out_stream, s, strlen(s));
+    return;
+  }
   while (*s)
     put_char(*s++);
 }
+
+// Errors bypass redirection and mark the running command as failed. They
+// are also collected into whole lines for the kernel log (dmesg).
+static int shell_status = 0;
+static char error_line[64];
+static int error_len = 0;
+void print_error(const char *s) {
+  stream_t *saved = out_stream;
+  shell_status = 1;
+  out_stream = NULL;
+  print(s);
+  out_stream = saved;
+  for (; *s; s++) {
+    if (*s == '\n') {
+      error_line[error_len] = 0;
+      klog(error_line);
+      error_len = 0;
+    } else if (error_len < (int)sizeof(error_line) - 1) {
+      error_line[error_len++] = *s;
+    }
+  }
+}
 void print_at(int x, int y, const char *s, uint8_t col) {
   int ix = x;
   while (*s) {
@@ -321,17 +383,32 @@ void strcat(char *d, const char *s) {
   while ((*d++ = *s++))
     ;
 }
+// Block fill/copy with rep stos/movs: 4 bytes per step, and whole cache
+// lines per step on CPUs with fast string microcode (every P6 and later).
 void *memset(void *s, int c, int n) {
-  unsigned char *p = (unsigned char *)s;
-  while (n--)
-    *p++ = (unsigned char)c;
+  void *p = s;
+  unsigned long words = n >= 0 ? (unsigned)n / 4 : 0;
+  unsigned long tail = n >= 0 ? (unsigned)n & 3 : 0;
+  uint32_t v = (uint8_t)c * 0x01010101U;
+  __asm__ volatile("rep stosl\n\t"
+                   "mov %3, %1\n\t"
+                   "rep stosb"
+                   : "+D"(p), "+c"(words)
+                   : "a"(v), "r"(tail)
+                   : "memory");
   return s;
 }
 void *memcpy(void *d, const void *s, int n) {
-  unsigned char *dd = (unsigned char *)d;
-  const unsigned char *ss = (const unsigned char *)s;
-  while (n--)
-    *dd++ = *ss++;
+  void *dd = d;
+  const void *ss = s;
+  unsigned long words = n >= 0 ? (unsigned)n / 4 : 0;
+  unsigned long tail = n >= 0 ? (unsigned)n & 3 : 0;
+  __asm__ volatile("rep movsl\n\t"
+                   "mov %3, %2\n\t"
+                   "rep movsb"
+                   : "+D"(dd), "+S"(ss), "+c"(words)
+                   : "r"(tail)
+                   : "memory");
   return d;
 }
 void itoa(int n, char *buf) {
@@ -363,6 +440,79 @@ void delay_ms(int ms) {
 void cpuid(uint32_t code, uint32_t *a, uint32_t *d) {
   __asm__ volatile("cpuid" : "=a"(*a), "=d"(*d) : "a"(code) : "ecx", "ebx");
 }
+void cpuid_regs(uint32_t leaf, uint32_t sub, uint32_t *r) {
+  __asm__ volatile("cpuid"
+                   : "=a"(r[0]), "=b"(r[1]), "=c"(r[2]), "=d"(r[3])
+                   : "a"(leaf), "c"(sub));
+}
+
+/* ============= CPU FEATURES ============= */
+// Feature words read once by cpu_detect(), indexed by cpu_flag_t.reg
+#define CPU_LEAF1_EDX 0
+#define CPU_LEAF1_ECX 1
+#define CPU_LEAF7_EBX 2
+#define CPU_EXT7_EDX 3
+typedef struct {
+  const char *name;
+  uint8_t reg;
+  uint8_t bit;
+} cpu_flag_t;
+static const cpu_flag_t cpu_flags[] = {
+    {"fpu", CPU_LEAF1_EDX, 0},    {"tsc", CPU_LEAF1_EDX, 4},
+    {"pse", CPU_LEAF1_EDX, 3},    {"pae", CPU_LEAF1_EDX, 6},
+    {"apic", CPU_LEAF1_EDX, 9},   {"mtrr", CPU_LEAF1_EDX, 12},
+    {"pge", CPU_LEAF1_EDX, 13},   {"pat", CPU_LEAF1_EDX, 16},
+    {"fxsr", CPU_LEAF1_EDX, 24},  {"sse", CPU_LEAF1_EDX, 25},
+    {"sse2", CPU_LEAF1_EDX, 26},  {"sse3", CPU_LEAF1_ECX, 0},
+    {"ssse3", CPU_LEAF1_ECX, 9},  {"sse4_1", CPU_LEAF1_ECX, 19},
+    {"sse4_2", CPU_LEAF1_ECX, 20}, {"xsave", CPU_LEAF1_ECX, 26},
+    {"avx", CPU_LEAF1_ECX, 28},   {"avx2", CPU_LEAF7_EBX, 5},
+    {"erms", CPU_LEAF7_EBX, 9},   {"invtsc", CPU_EXT7_EDX, 8},
+};
+#define CPU_FLAG_COUNT (int)(sizeof(cpu_flags) / sizeof(cpu_flags[0]))
+static uint32_t cpu_words[4];
+static char cpu_vendor[13];
+static char cpu_brand[49];
+static uint32_t cpu_family, cpu_model, cpu_stepping;
+
+void cpu_detect() {
+  uint32_t r[4];
+  cpuid_regs(0, 0, r);
+  uint32_t max = r[0];
+  memcpy(cpu_vendor, &r[1], 4);
+  memcpy(cpu_vendor + 4, &r[3], 4);
+  memcpy(cpu_vendor + 8, &r[2], 4);
+  if (max >= 1) {
+    cpuid_regs(1, 0, r);
+    cpu_words[CPU_LEAF1_EDX] = r[3];
+    cpu_words[CPU_LEAF1_ECX] = r[2];
+    cpu_stepping = r[0] & 0xF;
+    cpu_model = (r[0] >> 4) & 0xF;
+    cpu_family = (r[0] >> 8) & 0xF;
+    if (cpu_family == 0x6 || cpu_family == 0xF)
+      cpu_model |= ((r[0] >> 16) & 0xF) << 4;
+    if (cpu_family == 0xF)
+      cpu_family += (r[0] >> 20) & 0xFF;
+  }
+  if (max >= 7) {
+    cpuid_regs(7, 0, r);
+    cpu_words[CPU_LEAF7_EBX] = r[1];
+  }
+  cpuid_regs(0x80000000, 0, r);
+  uint32_t ext_max = r[0];
+  if (ext_max >= 0x80000004) {
+    for (uint32_t i = 0; i < 3; i++)
+      cpuid_regs(0x80000002 + i, 0, (uint32_t *)(cpu_brand + i * 16));
+  }
+  if (ext_max >= 0x80000007) {
+    cpuid_regs(0x80000007, 0, r);
+    cpu_words[CPU_EXT7_EDX] = r[3];
+  }
+}
+
+int cpu_has_flag(int i) {
+  return (cpu_words[cpu_flags[i].reg] >> cpu_flags[i].bit) & 1;
+}
 
 /* ============= TIME & FS ============= */
 uint8_t get_rtc(int reg) {
@@ -412,8 +562,10 @@ typedef struct {
   char data[MAX_FILE_SIZE];
   int size;
   bool used;
+  uint32_t version; // bumped on every write, used to invalidate caches
 } file_t;
 static file_t fs_table[MAX_FILES];
+static uint32_t fs_version_seq = 0;
 static char current_path[64] = "/";
 
 void fs_init() {
@@ -467,6 +619,7 @@ int fs_write_file(const char *name, const char *data, int size) {
   fs_table[id].data[size] = 0;
   fs_table[id].size = size;
   fs_table[id].used = true;
+  fs_table[id].version = ++fs_version_seq;
   return id;
 }
 
@@ -484,6 +637,7 @@ int fs_append_file(const char *name, const char *data, int size) {
   memcpy(fs_table[id].data + fs_table[id].size, data, size);
   fs_table[id].size += size;
   fs_table[id].data[fs_table[id].size] = 0;
+  fs_table[id].version = ++fs_version_seq;
   return size;
 }
 
@@ -516,6 +670,22 @@ int str_contains(const char *s, const char *needle) {
   return 0;
 }
 
+// Whether word appears in s as a whole space-separated token
+int str_has_word(const char *s, const char *word) {
+  int len = strlen(word);
+  while (*s) {
+    while (is_space(*s))
+      s++;
+    int n = 0;
+    while (s[n] && !is_space(s[n]))
+      n++;
+    if (n == len && strncmp(s, word, len) == 0)
+      return 1;
+    s += n;
+  }
+  return 0;
+}
+
 int is_space(char c) {
   return c == ' ' || c == '\n' || c == '\t' || c == '\r';
 }
@@ -582,7 +752,7 @@ const char *command_desc(const char *cmd) {
   if (strcmp(cmd, "date") == 0)
     return "date: Tarih ve saat bilgisini gosterir.";
   if (strcmp(cmd, "time") == 0)
-    return "time: Sistem saatini gosterir.";
+    return "time: Sistem saatini gosterir; time <komut> sureyi olcer.";
   if (strcmp(cmd, "matrix") == 0)
     return "matrix: Matrix efektini calistirir.";
   if (strcmp(cmd, "ls") == 0 || strcmp(cmd, "dir") == 0)
@@ -631,6 +801,16 @@ const char *command_desc(const char *cmd) {
     return "df: RAMDisk kullanimini gosterir.";
   if (strcmp(cmd, "wc") == 0)
     return "wc: Dosya satir/kelime/byte sayar.";
+  if (strcmp(cmd, "bench") == 0)
+    return "bench: Cekirdek mikro-benchmark setini calistirir.";
+  if (strcmp(cmd, "dmesg") == 0)
+    return "dmesg: Cekirdek log kayitlarini gosterir.";
+  if (strcmp(cmd, "set") == 0)
+    return "set: Degisken atar veya listeler (set <ad> <deger>).";
+  if (strcmp(cmd, "run") == 0)
+    return "run: Betik calistirir (set, repeat <n> ... end, $ad).";
+  if (strcmp(cmd, "grep") == 0)
+    return "grep: Metin iceren satirlari gosterir (cmd | grep <metin>).";
   return 0;
 }
 
@@ -667,6 +847,12 @@ int command_runs_without_args(const char *cmd) {
     return 1;
   if (strcmp(cmd, "df") == 0)
     return 1;
+  if (strcmp(cmd, "set") == 0)
+    return 1;
+  if (strcmp(cmd, "bench") == 0)
+    return 1;
+  if (strcmp(cmd, "dmesg") == 0)
+    return 1;
   return 0;
 }
 
@@ -982,6 +1168,23 @@ void ls_current_dir() {
   }
 }
 
+/* ============= SERIAL (COM1) ============= */
+#define COM1 0x3F8
+void serial_init() {
+  outb(COM1 + 1, 0x00); // no interrupts
+  outb(COM1 + 3, 0x80); // DLAB on
+  outb(COM1 + 0, 0x01); // 115200 baud
+  outb(COM1 + 1, 0x00);
+  outb(COM1 + 3, 0x03); // 8N1
+  outb(COM1 + 2, 0xC7); // FIFO on, cleared, 14-byte threshold
+  outb(COM1 + 4, 0x0B);
+}
+void serial_put_char(char c) {
+  while (!(inb(COM1 + 5) & 0x20))
+    ;
+  outb(COM1, c);
+}
+
 /* ============= KEYBOARD ============= */
 char get_any_scancode() {
   if (!(inb(0x64) & 1))
@@ -1206,14 +1409,1453 @@ void game_pong() {
   clear_screen();
 }
 
+/* ============= STREAMS & PIPES ============= */
+// Command output goes to a stream: the console, the next pipeline stage or a
+// RAMDisk file. Pipe stages buffer at most PIPE_RING_SIZE bytes; when the
+// ring fills up it is drained through the stage's filter, so no command ever
+// materialises its whole output.
+#define PIPE_RING_SIZE 256
+#define PIPE_LINE_SIZE 128
+#define MAX_PIPE_STAGES 4
+#define STREAM_CONSOLE 0
+#define STREAM_PIPE 1
+#define STREAM_FILE 2
+#define STREAM_SERIAL 3
+#define FILTER_CAT 0
+#define FILTER_GREP 1
+#define FILTER_WC 2
+
+typedef struct pipe_stage pipe_stage_t;
+struct stream {
+  int kind;
+  pipe_stage_t *stage; // STREAM_PIPE
+  char path[64];       // STREAM_FILE
+};
+
+struct pipe_stage {
+  char ring[PIPE_RING_SIZE];
+  int head, count;
+  int filter;
+  char pattern[32];
+  char line[PIPE_LINE_SIZE];
+  int line_len;
+  int lines, words, bytes;
+  bool in_word;
+  char last;
+  stream_t out;
+};
+
+static pipe_stage_t pipe_stages[MAX_PIPE_STAGES];
+
+void stream_print(stream_t *st, const char *s) { stream_write(st, s, strlen(s)); }
+
+void pipe_stage_init(pipe_stage_t *ps, int filter, const char *pattern,
+                     stream_t *out) {
+  memset(ps, 0, sizeof(pipe_stage_t));
+  ps->filter = filter;
+  if (pattern) {
+    int n = strlen(pattern);
+    if (n > 31)
+      n = 31;
+    memcpy(ps->pattern, pattern, n);
+    ps->pattern[n] = 0;
+  }
+  ps->out = *out;
+}
+
+void pipe_flush_line(pipe_stage_t *ps) {
+  ps->line[ps->line_len] = 0;
+  if (str_contains(ps->line, ps->pattern)) {
+    stream_write(&ps->out, ps->line, ps->line_len);
+    stream_write(&ps->out, "\n", 1);
+  }
+  ps->line_len = 0;
+}
+
+void pipe_filter_char(pipe_stage_t *ps, char c) {
+  if (ps->filter == FILTER_GREP) {
+    if (c == '\n' || ps->line_len == PIPE_LINE_SIZE - 1) {
+      pipe_flush_line(ps);
+      if (c == '\n')
+        return;
+    }
+    ps->line[ps->line_len++] = c;
+  } else if (ps->filter == FILTER_WC) {
+    ps->bytes++;
+    if (c == '\n')
+      ps->lines++;
+    if (is_space(c)) {
+      ps->in_word = false;
+    } else if (!ps->in_word) {
+      ps->in_word = true;
+      ps->words++;
+    }
+    ps->last = c;
+  }
+}
+
+void pipe_drain(pipe_stage_t *ps) {
+  while (ps->count > 0) {
+    int n = PIPE_RING_SIZE - ps->head;
+    if (n > ps->count)
+      n = ps->count;
+    const char *chunk = ps->ring + ps->head;
+    ps->head = (ps->head + n) % PIPE_RING_SIZE;
+    ps->count -= n;
+    if (ps->filter == FILTER_CAT) {
+      stream_write(&ps->out, chunk, n);
+    } else {
+      for (int i = 0; i < n; i++)
+        pipe_filter_char(ps, chunk[i]);
+    }
+  }
+}
+
+// Called once the upstream command has finished writing.
+void pipe_finish(pipe_stage_t *ps) {
+  pipe_drain(ps);
+  if (ps->filter == FILTER_GREP && ps->line_len > 0) {
+    pipe_flush_line(ps);
+  } else if (ps->filter == FILTER_WC) {
+    char buf[16];
+    int lines = ps->lines;
+    if (ps->bytes > 0 && ps->last != '\n')
+      lines++;
+    stream_print(&ps->out, "Lines: ");
+    itoa(lines, buf);
+    stream_print(&ps->out, buf);
+    stream_print(&ps->out, "  Words: ");
+    itoa(ps->words, buf);
+    stream_print(&ps->out, buf);
+    stream_print(&ps->out, "  Bytes: ");
+    itoa(ps->bytes, buf);
+    stream_print(&ps->out, buf);
+    stream_print(&ps->out, "\n");
+  }
+}
+
+void stream_write(stream_t *st, const char *s, int n) {
+  if (st->kind == STREAM_FILE) {
+    fs_append_file(st->path, s, n);
+  } else if (st->kind == STREAM_PIPE) {
+    pipe_stage_t *ps = st->stage;
+    while (n > 0) {
+      if (ps->count == PIPE_RING_SIZE)
+        pipe_drain(ps);
+      int tail = (ps->head + ps->count) % PIPE_RING_SIZE;
+      int room = PIPE_RING_SIZE - ps->count;
+      if (room > PIPE_RING_SIZE - tail)
+        room = PIPE_RING_SIZE - tail;
+      if (room > n)
+        room = n;
+      memcpy(ps->ring + tail, s, room);
+      ps->count += room;
+      s += room;
+      n -= room;
+    }
+  } else if (st->kind == STREAM_SERIAL) {
+    for (int i = 0; i < n; i++)
+      serial_put_char(s[i]);
+  } else {
+    for (int i = 0; i < n; i++)
+      put_char(s[i]);
+  }
+}
+
+int pipe_filter_id(const char *name) {
+  if (strcmp(name, "cat") == 0)
+    return FILTER_CAT;
+  if (strcmp(name, "grep") == 0)
+    return FILTER_GREP;
+  if (strcmp(name, "wc") == 0)
+    return FILTER_WC;
+  return -1;
+}
+
+char *trim_spaces(char *s) {
+  while (*s == ' ' || *s == '\t')
+    s++;
+  int len = strlen(s);
+  while (len > 0 && (s[len - 1] == ' ' || s[len - 1] == '\t'))
+    s[--len] = 0;
+  return s;
+}
+
+/* ============= VARIABLES & SCRIPTS ============= */
+#define MAX_VARS 16
+typedef struct {
+  char name[16];
+  char value[48];
+  bool used;
+} shell_var_t;
+static shell_var_t shell_vars[MAX_VARS];
+
+int var_name_char(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_';
+}
+
+shell_var_t *var_find(const char *name, int len) {
+  for (int i = 0; i < MAX_VARS; i++)
+    if (shell_vars[i].used && strncmp(shell_vars[i].name, name, len) == 0 &&
+        shell_vars[i].name[len] == 0)
+      return &shell_vars[i];
+  return 0;
+}
+
+int var_set(const char *name, const char *value) {
+  int len = strlen(name);
+  if (len == 0 || len >= 16)
+    return 0;
+  for (int i = 0; i < len; i++)
+    if (!var_name_char(name[i]))
+      return 0;
+  shell_var_t *v = var_find(name, len);
+  for (int i = 0; !v && i < MAX_VARS; i++)
+    if (!shell_vars[i].used)
+      v = &shell_vars[i];
+  if (!v)
+    return 0;
+  strcpy(v->name, name);
+  int n = strlen(value);
+  if (n > 47)
+    n = 47;
+  memcpy(v->value, value, n);
+  v->value[n] = 0;
+  v->used = true;
+  return 1;
+}
+
+// Replaces $NAME references; unknown names expand to nothing.
+// Returns 0 if the result does not fit in size bytes.
+int var_expand(const char *src, char *dst, int size) {
+  int n = 0;
+  while (*src) {
+    if (*src == '$' && var_name_char(src[1])) {
+      const char *name = ++src;
+      while (var_name_char(*src))
+        src++;
+      shell_var_t *v = var_find(name, src - name);
+      const char *val = v ? v->value : "";
+      while (*val) {
+        if (n >= size - 1)
+          return 0;
+        dst[n++] = *val++;
+      }
+      continue;
+    }
+    if (n >= size - 1)
+      return 0;
+    dst[n++] = *src++;
+  }
+  dst[n] = 0;
+  return 1;
+}
+
+// Scripts are parsed once into ops whose strings live in a per-script pool.
+// A cached script is reused for as long as the file version is unchanged.
+#define SOP_CMD 0    // pre-split command, dispatched straight to shell_exec
+#define SOP_VCMD 1   // command with $vars, expanded and split when run
+#define SOP_LINE 2   // pipeline or redirect, handed to shell_run_line
+#define SOP_SET 3
+#define SOP_REPEAT 4
+#define SOP_END 5
+#define MAX_SCRIPT_OPS 96
+#define MAX_SCRIPT_DEPTH 4
+#define SCRIPT_POOL_SIZE (MAX_FILE_SIZE * 2)
+#define SCRIPT_CACHE_SLOTS 4
+
+typedef struct {
+  uint8_t op;
+  uint8_t argc;
+  uint16_t line;
+  uint16_t raw;     // pool offset of the source text
+  uint16_t arg[8];  // pool offsets of the tokens
+  uint16_t jump;    // REPEAT <-> END
+  uint16_t count;   // REPEAT iterations
+} script_op_t;
+
+typedef struct {
+  char name[32];
+  uint32_t version;
+  bool valid;
+  int nops;
+  script_op_t ops[MAX_SCRIPT_OPS];
+  char pool[SCRIPT_POOL_SIZE];
+} script_t;
+
+static script_t script_cache[SCRIPT_CACHE_SLOTS];
+static int script_cache_next = 0;
+static bool script_running = false;
+
+int script_error(const char *name, int line, const char *msg) {
+  char buf[8];
+  print_error("run: ");
+  print_error(name);
+  print_error(":");
+  itoa(line, buf);
+  print_error(buf);
+  print_error(": ");
+  print_error(msg);
+  print_error("\n");
+  return 0;
+}
+
+int script_parse(script_t *sc, const char *src) {
+  int pool = 0;
+  int depth = 0;
+  int open[MAX_SCRIPT_DEPTH];
+  int line_no = 0;
+  sc->nops = 0;
+  while (*src) {
+    const char *end = src;
+    while (*end && *end != '\n')
+      end++;
+    int len = end - src;
+    line_no++;
+    while (len > 0 && (src[len - 1] == '\r' || is_space(src[len - 1])))
+      len--;
+    while (len > 0 && is_space(*src)) {
+      src++;
+      len--;
+    }
+    const char *next = *end ? end + 1 : end;
+    if (len == 0 || *src == '#') {
+      src = next;
+      continue;
+    }
+    if (len > 63)
+      return script_error(sc->name, line_no, "line too long");
+    if (sc->nops == MAX_SCRIPT_OPS || pool + 2 * (len + 1) > SCRIPT_POOL_SIZE)
+      return script_error(sc->name, line_no, "script too large");
+
+    script_op_t *op = &sc->ops[sc->nops];
+    memset(op, 0, sizeof(script_op_t));
+    op->line = line_no;
+    op->raw = pool;
+    memcpy(sc->pool + pool, src, len);
+    sc->pool[pool + len] = 0;
+    pool += len + 1;
+    char *tokens = sc->pool + pool;
+    memcpy(tokens, src, len);
+    tokens[len] = 0;
+    pool += len + 1;
+
+    char *argv[8];
+    int argc = split_args(tokens, argv, 8);
+    op->argc = argc;
+    for (int i = 0; i < argc; i++)
+      op->arg[i] = argv[i] - sc->pool;
+
+    const char *raw = sc->pool + op->raw;
+    if (strcmp(argv[0], "repeat") == 0) {
+      const char *d = argc == 2 ? argv[1] : "";
+      int n = 0;
+      while (*d >= '0' && *d <= '9')
+        n = n * 10 + (*d++ - '0');
+      if (argc != 2 || *d || d == argv[1])
+        return script_error(sc->name, line_no, "usage: repeat <count>");
+      if (depth == MAX_SCRIPT_DEPTH)
+        return script_error(sc->name, line_no, "loops nested too deep");
+      op->op = SOP_REPEAT;
+      op->count = n > 9999 ? 9999 : n;
+      open[depth++] = sc->nops;
+    } else if (strcmp(argv[0], "end") == 0) {
+      if (depth == 0)
+        return script_error(sc->name, line_no, "'end' without 'repeat'");
+      op->op = SOP_END;
+      op->jump = open[--depth];
+      sc->ops[op->jump].jump = sc->nops;
+    } else if (strcmp(argv[0], "set") == 0 && argc >= 2) {
+      op->op = SOP_SET;
+    } else if (strcmp(argv[0], "run") == 0) {
+      return script_error(sc->name, line_no, "nested 'run' is not supported");
+    } else if (str_contains(raw, "|") || str_contains(raw, ">")) {
+      op->op = SOP_LINE;
+    } else if (str_contains(raw, "$")) {
+      op->op = SOP_VCMD;
+    } else {
+      op->op = SOP_CMD;
+    }
+    sc->nops++;
+    src = next;
+  }
+  if (depth > 0)
+    return script_error(sc->name, sc->ops[open[depth - 1]].line,
+                        "'repeat' without 'end'");
+  return 1;
+}
+
+script_t *script_load(const char *path) {
+  int id = fs_find_file(path);
+  if (id == -1)
+    return 0;
+  for (int i = 0; i < SCRIPT_CACHE_SLOTS; i++) {
+    script_t *sc = &script_cache[i];
+    if (sc->valid && sc->version == fs_table[id].version &&
+        strcmp(sc->name, path) == 0)
+      return sc;
+  }
+  // Reuse the stale entry for this file, otherwise evict round-robin
+  script_t *sc = 0;
+  for (int i = 0; i < SCRIPT_CACHE_SLOTS; i++)
+    if (script_cache[i].valid && strcmp(script_cache[i].name, path) == 0)
+      sc = &script_cache[i];
+  if (!sc) {
+    sc = &script_cache[script_cache_next];
+    script_cache_next = (script_cache_next + 1) % SCRIPT_CACHE_SLOTS;
+  }
+  strcpy(sc->name, path);
+  sc->version = fs_table[id].version;
+  sc->valid = script_parse(sc, fs_table[id].data);
+  return sc->valid ? sc : 0;
+}
+
+// Runs a cached script; stops at the first failing command.
+int script_run(script_t *sc) {
+  int iter[MAX_SCRIPT_DEPTH];
+  int depth = 0;
+  char buf[64];
+  char *argv[8];
+  int pc = 0;
+  while (pc < sc->nops) {
+    script_op_t *op = &sc->ops[pc];
+    char *raw = sc->pool + op->raw;
+    shell_status = 0;
+    if (op->op == SOP_REPEAT) {
+      if (op->count == 0) {
+        pc = op->jump + 1;
+        continue;
+      }
+      iter[depth++] = 1;
+      var_set("i", "1");
+      pc++;
+      continue;
+    }
+    if (op->op == SOP_END) {
+      script_op_t *head = &sc->ops[op->jump];
+      if (iter[depth - 1] < head->count) {
+        char nb[8];
+        itoa(++iter[depth - 1], nb);
+        var_set("i", nb);
+        pc = op->jump + 1;
+      } else {
+        depth--;
+        pc++;
+      }
+      continue;
+    }
+    if (op->op == SOP_SET) {
+      char *value = after_n_tokens(raw, 2);
+      if (!var_expand(value, buf, sizeof(buf)) ||
+          !var_set(sc->pool + op->arg[1], buf))
+        shell_status = 1;
+    } else if (op->op == SOP_CMD) {
+      for (int i = 0; i < op->argc; i++)
+        argv[i] = sc->pool + op->arg[i];
+      shell_exec(op->argc, argv, raw);
+    } else if (op->op == SOP_LINE) {
+      strcpy(buf, raw);
+      shell_run_line(buf);
+    } else if (var_expand(raw, buf, sizeof(buf))) {
+      char line[64];
+      strcpy(line, buf);
+      int argc = split_args(line, argv, 8);
+      if (argc > 0)
+        shell_exec(argc, argv, buf);
+    } else {
+      shell_status = 1;
+    }
+    if (shell_status != 0)
+      return script_error(sc->name, op->line, "command failed, stopping");
+    pc++;
+  }
+  return 1;
+}
+
+/* ============= TSC & BENCHMARKS ============= */
+static uint32_t tsc_khz = 0;
+
+int tsc_available() {
+  uint32_t a, d;
+  cpuid(1, &a, &d);
+  return (d >> 4) & 1;
+}
+
+// Divides *n by d in place and returns the remainder (no libgcc needed)
+uint32_t div64_32(uint64_t *n, uint32_t d) {
+  uint32_t hi = (uint32_t)(*n >> 32);
+  uint32_t lo = (uint32_t)*n;
+  uint32_t q_hi = hi / d;
+  uint32_t q_lo, rem;
+  hi %= d;
+  __asm__("divl %4" : "=a"(q_lo), "=d"(rem) : "a"(lo), "d"(hi), "rm"(d));
+  *n = ((uint64_t)q_hi << 32) | q_lo;
+  return rem;
+}
+
+void u64toa(uint64_t v, char *buf) {
+  char tmp[24];
+  int i = 0;
+  do {
+    tmp[i++] = '0' + div64_32(&v, 10);
+  } while (v);
+  for (int j = 0; j < i; j++)
+    buf[j] = tmp[i - 1 - j];
+  buf[i] = 0;
+}
+
+// Counts TSC ticks across a 50 ms one-shot of PIT channel 2
+void tsc_calibrate() {
+  const uint32_t latch = 1193182 / 20;
+  outb(0x61, (inb(0x61) & ~0x02) | 0x01);
+  outb(0x43, 0xB0);
+  outb(0x42, latch & 0xFF);
+  outb(0x42, (latch >> 8) & 0xFF);
+  uint64_t t0 = rdtsc();
+  while (!(inb(0x61) & 0x20))
+    ;
+  uint64_t cycles = rdtsc() - t0;
+  div64_32(&cycles, 50);
+  tsc_khz = (uint32_t)cycles;
+  if (tsc_khz == 0)
+    tsc_khz = 1;
+}
+
+uint64_t tsc_to_us(uint64_t cycles) {
+  if (!tsc_khz)
+    tsc_calibrate();
+  cycles *= 1000;
+  div64_32(&cycles, tsc_khz);
+  return cycles;
+}
+
+void print_u64(uint64_t v) {
+  char buf[24];
+  u64toa(v, buf);
+  print(buf);
+}
+
+void print_padded(const char *s, int width) {
+  print(s);
+  for (int n = strlen(s); n < width; n++)
+    print(" ");
+}
+
+// Prints a microsecond count as milliseconds with three decimals
+void print_ms(uint64_t us) {
+  uint32_t frac = div64_32(&us, 1000);
+  print_u64(us);
+  print(".");
+  char buf[4];
+  buf[0] = '0' + frac / 100;
+  buf[1] = '0' + (frac / 10) % 10;
+  buf[2] = '0' + frac % 10;
+  buf[3] = 0;
+  print(buf);
+  print(" ms");
+}
+
+#define BENCH_WARMUP 3
+#define BENCH_REPS 15
+#define BENCH_BUF_SIZE 16384
+#define BENCH_FS_BYTES 512
+#define BENCH_FIND_OPS 16
+#define BENCH_FS_FILE "bench.tmp" // scratch file, only used if it is absent
+static uint8_t bench_src[BENCH_BUF_SIZE];
+static uint8_t bench_dst[BENCH_BUF_SIZE];
+static bool bench_fs_owned = false; // BENCH_FS_FILE belongs to this run
+
+typedef struct {
+  const char *name;
+  int (*fn)();    // 0, or -1 if the operation failed
+  uint32_t bytes; // bytes per rep, reported as MB/s
+  uint32_t ops;   // operations per rep, reported as ops/s
+} bench_t;
+
+int bench_memcpy() {
+  memcpy(bench_dst, bench_src, BENCH_BUF_SIZE);
+  return 0;
+}
+int bench_memset() {
+  memset(bench_dst, 0x5A, BENCH_BUF_SIZE);
+  return 0;
+}
+int bench_fs_write() {
+  if (!bench_fs_owned)
+    return -1;
+  return fs_write_file(BENCH_FS_FILE, (const char *)bench_src,
+                       BENCH_FS_BYTES) < 0 ? -1 : 0;
+}
+// Runs after fs_write, which leaves BENCH_FS_FILE in the table
+int bench_fs_find_hit() {
+  if (!bench_fs_owned)
+    return -1;
+  for (int i = 0; i < BENCH_FIND_OPS; i++)
+    if (fs_find_file(BENCH_FS_FILE) < 0)
+      return -1;
+  return 0;
+}
+int bench_fs_find_miss() {
+  for (int i = 0; i < BENCH_FIND_OPS; i++)
+    fs_find_file("bench.missing");
+  return 0;
+}
+int bench_print() {
+  print("bench: ........................................................"
+        "..............\n");
+  return 0;
+}
+int bench_scroll() {
+  scroll();
+  return 0;
+}
+
+static const bench_t bench_suite[] = {
+    {"memcpy-16K", bench_memcpy, BENCH_BUF_SIZE, 0},
+    {"memset-16K", bench_memset, BENCH_BUF_SIZE, 0},
+    {"fs_write-512", bench_fs_write, BENCH_FS_BYTES, 0},
+    {"fs_find-hit", bench_fs_find_hit, 0, BENCH_FIND_OPS},
+    {"fs_find-miss", bench_fs_find_miss, 0, BENCH_FIND_OPS},
+    {"print-line", bench_print, 0, 1},
+    {"scroll", bench_scroll, 0, 1},
+};
+#define BENCH_COUNT (int)(sizeof(bench_suite) / sizeof(bench_suite[0]))
+
+// Runs fn BENCH_WARMUP times untimed, then BENCH_REPS timed repetitions.
+// samples receives the sorted per-rep cycle counts. Returns -1, with no
+// samples, as soon as one call fails.
+int bench_measure(int (*fn)(), uint32_t *samples) {
+  for (int i = 0; i < BENCH_WARMUP; i++)
+    if (fn() < 0)
+      return -1;
+  for (int i = 0; i < BENCH_REPS; i++) {
+    uint64_t t0 = rdtsc();
+    int rc = fn();
+    samples[i] = (uint32_t)(rdtsc() - t0);
+    if (rc < 0)
+      return -1;
+  }
+  for (int i = 1; i < BENCH_REPS; i++) {
+    uint32_t v = samples[i];
+    int j = i - 1;
+    while (j >= 0 && samples[j] > v) {
+      samples[j + 1] = samples[j];
+      j--;
+    }
+    samples[j + 1] = v;
+  }
+  return 0;
+}
+
+// Failed tests get an "error:" line instead of timings, which also makes
+// scripts/bench.sh reject the run
+void bench_run_suite() {
+  uint32_t samples[BENCH_COUNT][BENCH_REPS];
+  int status[BENCH_COUNT];
+  if (!tsc_khz)
+    tsc_calibrate();
+  for (int i = 0; i < BENCH_BUF_SIZE; i++)
+    bench_src[i] = (uint8_t)(i * 7);
+
+  // Never overwrite or delete a user's file
+  bench_fs_owned = fs_find_file(BENCH_FS_FILE) < 0;
+  if (!bench_fs_owned)
+    print("error: " BENCH_FS_FILE " exists, remove it to run the fs tests\n");
+
+  // Console benchmarks must hit the VGA path even when output is redirected
+  stream_t *saved = out_stream;
+  out_stream = NULL;
+  for (int i = 0; i < BENCH_COUNT; i++)
+    status[i] = bench_measure(bench_suite[i].fn, samples[i]);
+  out_stream = saved;
+  if (bench_fs_owned)
+    fs_delete_file(BENCH_FS_FILE);
+  bench_fs_owned = false;
+
+  print("TSC: ");
+  print_u64(tsc_khz);
+  print(" kHz, ");
+  print_u64(BENCH_REPS);
+  print(" reps, cycles per rep\n");
+  print_padded("test", 14);
+  print_padded("min", 11);
+  print_padded("median", 11);
+  print_padded("max", 11);
+  print("rate\n");
+  for (int i = 0; i < BENCH_COUNT; i++) {
+    char buf[24];
+    const bench_t *b = &bench_suite[i];
+    if (status[i] < 0) {
+      print("error: ");
+      print(b->name);
+      print(" failed\n");
+      shell_status = 1;
+      continue;
+    }
+    uint32_t med = samples[i][BENCH_REPS / 2];
+    print_padded(b->name, 14);
+    u64toa(samples[i][0], buf);
+    print_padded(buf, 11);
+    u64toa(med, buf);
+    print_padded(buf, 11);
+    u64toa(samples[i][BENCH_REPS - 1], buf);
+    print_padded(buf, 11);
+    // rate = units * cycles-per-second / median
+    uint64_t rate = (uint64_t)(b->bytes ? b->bytes : b->ops) * tsc_khz * 1000;
+    div64_32(&rate, med ? med : 1);
+    if (b->bytes) {
+      div64_32(&rate, 1000000);
+      print_u64(rate);
+      print(" MB/s\n");
+    } else {
+      print_u64(rate);
+      print(" ops/s\n");
+    }
+  }
+}
+
+/* ============= KERNEL LOG (dmesg) ============= */
+// Fixed ring of timestamped records. Writers never wait: klog() takes the
+// next sequence number with one atomic add and overwrites the oldest
+// record, so it is safe from any context, IRQ handlers included. A
+// record's seq field is 0 while it is being written and seq + 1 once it is
+// complete; readers copy a record and keep it only if seq matched before
+// and after the copy. COM1 output is drained later from the shell's idle
+// loop, a FIFO's worth at a time, so logging never waits for the UART.
+#define LOG_RECORDS 256 // power of two
+#define LOG_TEXT 52     // 64-byte records
+#define LOG_LINE_SIZE (LOG_TEXT + 24)
+typedef struct {
+  uint32_t seq;
+  uint32_t len;
+  uint64_t tsc;
+  char text[LOG_TEXT];
+} log_record_t;
+static log_record_t log_ring[LOG_RECORDS];
+static uint32_t log_next = 0; // next sequence number to hand out
+static uint64_t log_tsc_base = 0;
+static bool log_has_tsc = false;
+
+void log_init() {
+  log_has_tsc = tsc_available();
+  if (log_has_tsc) {
+    log_tsc_base = rdtsc();
+    tsc_calibrate();
+  }
+  serial_init();
+}
+
+void klog(const char *msg) {
+  uint32_t seq = __atomic_fetch_add(&log_next, 1, __ATOMIC_RELAXED);
+  log_record_t *r = &log_ring[seq & (LOG_RECORDS - 1)];
+  __atomic_store_n(&r->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  r->tsc = log_has_tsc ? rdtsc() : 0;
+  uint32_t n = 0;
+  for (; msg[n] && n < LOG_TEXT; n++)
+    r->text[n] = msg[n] == '\n' ? ' ' : msg[n];
+  while (n > 0 && r->text[n - 1] == ' ')
+    n--;
+  r->len = n;
+  __atomic_store_n(&r->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+// Copies record seq: 1 if copied, 0 if it is still being written, -1 if it
+// was overwritten
+int log_read(uint32_t seq, log_record_t *out) {
+  log_record_t *r = &log_ring[seq & (LOG_RECORDS - 1)];
+  uint32_t s = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+  if (s == 0)
+    return 0;
+  if (s != seq + 1)
+    return -1;
+  out->tsc = r->tsc;
+  out->len = r->len;
+  memcpy(out->text, r->text, LOG_TEXT);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&r->seq, __ATOMIC_RELAXED) == s ? 1 : -1;
+}
+
+uint32_t log_oldest(uint32_t end) {
+  return end > LOG_RECORDS ? end - LOG_RECORDS : 0;
+}
+
+// "[    s.uuuuuu] text\n", seconds since boot
+int log_format(const log_record_t *r, char *out) {
+  uint64_t us = log_has_tsc ? tsc_to_us(r->tsc - log_tsc_base) : 0;
+  uint32_t usec = div64_32(&us, 1000000);
+  char sec[24];
+  int n = 0;
+  u64toa(us, sec);
+  out[n++] = '[';
+  for (int len = strlen(sec); len < 5; len++)
+    out[n++] = ' ';
+  for (char *p = sec; *p; p++)
+    out[n++] = *p;
+  out[n++] = '.';
+  for (uint32_t div = 100000; div; div /= 10)
+    out[n++] = '0' + (usec / div) % 10;
+  out[n++] = ']';
+  out[n++] = ' ';
+  memcpy(out + n, r->text, r->len);
+  n += r->len;
+  out[n++] = '\n';
+  out[n] = 0;
+  return n;
+}
+
+void dmesg_print() {
+  uint32_t end = __atomic_load_n(&log_next, __ATOMIC_ACQUIRE);
+  char line[LOG_LINE_SIZE];
+  log_record_t rec;
+  for (uint32_t seq = log_oldest(end); seq != end; seq++) {
+    if (log_read(seq, &rec) > 0) {
+      log_format(&rec, line);
+      print(line);
+    }
+  }
+}
+
+// Serial drain state; only the shell loop drains, so no atomics here
+static uint32_t log_drain_seq = 0;
+static char log_drain_line[LOG_LINE_SIZE];
+static int log_drain_len = 0;
+static int log_drain_pos = 0;
+
+// Loads the next line to send; 0 if there is none yet
+int log_drain_next() {
+  uint32_t end = __atomic_load_n(&log_next, __ATOMIC_ACQUIRE);
+  if (end - log_drain_seq > LOG_RECORDS) {
+    char num[24];
+    u64toa(log_oldest(end) - log_drain_seq, num);
+    strcpy(log_drain_line, "[dmesg] ");
+    strcat(log_drain_line, num);
+    strcat(log_drain_line, " records lost\n");
+    log_drain_len = strlen(log_drain_line);
+    log_drain_pos = 0;
+    log_drain_seq = log_oldest(end);
+    return 1;
+  }
+  while (log_drain_seq != end) {
+    log_record_t rec;
+    int st = log_read(log_drain_seq, &rec);
+    if (st == 0)
+      return 0;
+    log_drain_seq++;
+    if (st > 0) {
+      log_drain_len = log_format(&rec, log_drain_line);
+      log_drain_pos = 0;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Sends at most one FIFO load (16 bytes) and only if the UART is idle
+void log_drain_serial() {
+  if (!(inb(COM1 + 5) & 0x20))
+    return;
+  for (int i = 0; i < 16; i++) {
+    if (log_drain_pos == log_drain_len && !log_drain_next())
+      return;
+    outb(COM1, log_drain_line[log_drain_pos++]);
+  }
+}
+
 /* ============= SHELL CORE v3.7 (NOVA ULTIMATE FIX) ============= */
 #define HISTORY_SIZE 8
 static char history_buf[HISTORY_SIZE][64];
 static int history_count = 0;
-void shell_loop() {
-  char line[64];
+void shell_exec(int argc, char **argv, char *raw_line) {
+  shell_status = 0;
+  if (argc == 1) {
+    const char *desc = command_desc(argv[0]);
+    if (desc) {
+      print(desc);
+      print("\n");
+      if (!command_runs_without_args(argv[0])) {
+        shell_status = 1;
+        return;
+      }
+    }
+  }
+
+  if (strcmp(argv[0], "help") == 0) {
+    set_color(col_accent, col_bg >> 4);
+    print("\nTARKOS NOVA ULTIMATE - CONSOLE ASSISTANCE\n");
+    set_color(0x0F, col_bg >> 4);
+    print("- FS: ls, cat, touch, rm, cd, mkdir, rmdir, cp, mv, pwd, write, "
+          "append, stat, find\n");
+    print("- App: tredit, cls, ver, reboot, time, date, echo, matrix, "
+          "cpuinfo, calc, themes, sysinfo, pong, history\n");
+    print("- Info: about, df, wc, grep, bench, dmesg, time <cmd>\n");
+    print("- Pipe: cmd | grep <text> | wc, cmd > file, cmd >> file\n");
+    print("- Script: run <file>, set <name> <value>, $name\n");
+    print("- UI: 9.4s Hyper Boot [Enabled]\n");
+  } else if (strcmp(argv[0], "sysinfo") == 0) {
+    print("TarkOS Nova v1.9.6 [Eternal Edition]\n");
+    print("Build: 2026-01-30.01\n");
+    print("Kernel: 32-bit x86 Protected Mode\n");
+    print("Memory Manager: PMM + Paging [Active]\n");
+    print("CPU: Multiboot Detected 3-Core SMP\n");
+    print("GUI: Zero-Flicker Dual-Bar [Stable]\n");
+  } else if (strcmp(argv[0], "about") == 0) {
+    print("TarkOS Nova v1.9.6 Ultimate\n");
+    print("Hyper Boot: 9.4s | SMP x3 | RAM 512MB\n");
+    print("VFS: RAMDisk | Shell: Nova Console v3.7\n");
+    print("Themes: dark, neon, classic\n");
+  } else if (strcmp(argv[0], "df") == 0) {
+    int used_files = fs_used_files();
+    int used_bytes = fs_used_bytes();
+    int total_files = MAX_FILES;
+    int total_bytes = MAX_FILES * (MAX_FILE_SIZE - 1);
+    char buf[16];
+    print("Files: ");
+    itoa(used_files, buf);
+    print(buf);
+    print("/");
+    itoa(total_files, buf);
+    print(buf);
+    print("\nData: ");
+    itoa(used_bytes, buf);
+    print(buf);
+    print("/");
+    itoa(total_bytes, buf);
+    print(buf);
+    print(" bytes\n");
+  } else if (strcmp(argv[0], "wc") == 0) {
+    if (argc < 2) {
+      print_error("Usage: wc <filename>\n");
+    } else {
+      char path[64];
+      if (!build_path(argv[1], path)) {
+        print_error("Error: Invalid path.\n");
+      } else {
+        int id = fs_find_file(path);
+        if (id != -1) {
+          int lines = count_lines(fs_table[id].data);
+          int words = count_words(fs_table[id].data);
+          int bytes = fs_table[id].size;
+          char buf[16];
+          print("Lines: ");
+          itoa(lines, buf);
+          print(buf);
+          print("  Words: ");
+          itoa(words, buf);
+          print(buf);
+          print("  Bytes: ");
+          itoa(bytes, buf);
+          print(buf);
+          print("\n");
+        } else {
+          print_error("Error: File not found.\n");
+        }
+      }
+    }
+  } else if (strcmp(argv[0], "cpuinfo") == 0) {
+    char buf[16];
+    const char *brand = cpu_brand;
+    while (*brand == ' ')
+      brand++;
+    print("CPU Vendor: ");
+    print(cpu_vendor[0] ? cpu_vendor : "Unknown");
+    print("\nCPU Model : ");
+    print(*brand ? brand : "-");
+    print("\nFamily ");
+    itoa(cpu_family, buf);
+    print(buf);
+    print("  Model ");
+    itoa(cpu_model, buf);
+    print(buf);
+    print("  Stepping ");
+    itoa(cpu_stepping, buf);
+    print(buf);
+    print("\nFeatures  :");
+    for (int i = 0; i < CPU_FLAG_COUNT; i++) {
+      if (cpu_has_flag(i)) {
+        print(" ");
+        print(cpu_flags[i].name);
+      }
+    }
+    print("\n");
+  } else if (strcmp(argv[0], "calc") == 0) {
+    int res = 0;
+    if (calc_eval(raw_line + 4, &res)) {
+      char buf[16];
+      itoa(res, buf);
+      print("Result: ");
+      print(buf);
+      print("\n");
+    } else {
+      print_error("Usage: calc <a> <op> <b>\n");
+    }
+  } else if (strcmp(argv[0], "themes") == 0) {
+    if (argc == 2 && strcmp(argv[1], "dark") == 0)
+      set_theme(0);
+    else if (argc == 2 && strcmp(argv[1], "neon") == 0)
+      set_theme(1);
+    else if (argc == 2 && strcmp(argv[1], "classic") == 0)
+      set_theme(2);
+    else
+      print_error("Usage: themes [dark|neon|classic]\n");
+  } else if (strcmp(argv[0], "echo") == 0) {
+    char *msg = after_n_tokens(raw_line, 1);
+    if (*msg) {
+      print(msg);
+      print("\n");
+    }
+  } else if (strcmp(argv[0], "date") == 0) {
+    char tb[16];
+    char db[16];
+    get_time_str(tb);
+    get_date_str(db);
+    print("Today is: ");
+    print(db);
+    print(" | Local Time: ");
+    print(tb);
+    print("\n");
+  } else if (strcmp(argv[0], "time") == 0) {
+    if (argc == 1) {
+      char tb[16];
+      get_time_str(tb);
+      print("System Time: ");
+      print(tb);
+      print("\n");
+    } else if (!tsc_available()) {
+      print_error("Error: CPU has no TSC.\n");
+    } else {
+      char line[64];
+      strcpy(line, after_n_tokens(raw_line, 1));
+      if (!tsc_khz)
+        tsc_calibrate();
+      uint64_t t0 = rdtsc();
+      shell_run_line(line);
+      uint64_t cycles = rdtsc() - t0;
+      int status = shell_status;
+      print("Cycles: ");
+      print_u64(cycles);
+      print("  Wall: ");
+      print_ms(tsc_to_us(cycles));
+      print("\n");
+      shell_status = status;
+    }
+  } else if (strcmp(argv[0], "dmesg") == 0) {
+    dmesg_print();
+  } else if (strcmp(argv[0], "bench") == 0) {
+    if (!tsc_available())
+      print_error("Error: CPU has no TSC.\n");
+    else
+      bench_run_suite();
+  } else if (strcmp(argv[0], "matrix") == 0) {
+    effect_matrix();
+  } else if (strcmp(argv[0], "ls") == 0 || strcmp(argv[0], "dir") == 0) {
+    if (argc == 1) {
+      ls_current_dir();
+    } else if (strcmp(argv[1], "/") == 0) {
+      ls_dir_path("/");
+    } else {
+      char path[64];
+      if (build_path(argv[1], path))
+        ls_dir_path(path);
+      else
+        print_error("Error: Invalid path.\n");
+    }
+  } else if (strcmp(argv[0], "pwd") == 0) {
+    print(current_path);
+    print("\n");
+  } else if (strcmp(argv[0], "cd") == 0) {
+    if (argc == 1) {
+      print(current_path);
+      print("\n");
+    } else {
+      char new_path[64];
+      if (strcmp(argv[1], "/") == 0) {
+        strcpy(current_path, "/");
+      } else if (strcmp(argv[1], "..") == 0) {
+        path_parent(current_path, new_path);
+        strcpy(current_path, new_path);
+      } else if (strcmp(argv[1], ".") == 0) {
+      } else {
+        if (argv[1][0] == '/') {
+          strcpy(new_path, argv[1]);
+        } else if (strcmp(current_path, "/") == 0) {
+          new_path[0] = '/';
+          new_path[1] = 0;
+          strcat(new_path, argv[1]);
+        } else {
+          strcpy(new_path, current_path);
+          strcat(new_path, "/");
+          strcat(new_path, argv[1]);
+        }
+        if (fs_dir_exists(new_path))
+          strcpy(current_path, new_path);
+        else
+          print_error("Error: Directory not found.\n");
+      }
+    }
+  } else if (strcmp(argv[0], "mkdir") == 0) {
+    if (argc < 2) {
+      print_error("Usage: mkdir <dirname>\n");
+    } else {
+      char path[64];
+      if (!build_path(argv[1], path)) {
+        print_error("Error: Invalid path.\n");
+      } else if (fs_mkdir(path)) {
+        print("Directory created.\n");
+      } else {
+        print_error("Error: Unable to create directory.\n");
+      }
+    }
+  } else if (strcmp(argv[0], "rmdir") == 0) {
+    if (argc < 2) {
+      print_error("Usage: rmdir <dirname>\n");
+    } else {
+      char path[64];
+      if (!build_path(argv[1], path)) {
+        print_error("Error: Invalid path.\n");
+      } else if (fs_rmdir(path) > 0) {
+        print("Directory removed.\n");
+      } else {
+        print_error("Error: Directory not found.\n");
+      }
+    }
+  } else if (strcmp(argv[0], "cat") == 0) {
+    if (argc < 2) {
+      print_error("Usage: cat <filename>\n");
+    } else {
+      char path[64];
+      build_path(argv[1], path);
+      int id = fs_find_file(path);
+      if (id != -1) {
+        print(fs_table[id].data);
+        print("\n");
+      } else
+        print_error("Error: File not found.\n");
+    }
+  } else if (strcmp(argv[0], "cp") == 0) {
+    if (argc < 3) {
+      print_error("Usage: cp <src> <dest>\n");
+    } else {
+      char src_path[64];
+      char dest_path[64];
+      build_path(argv[1], src_path);
+      build_path(argv[2], dest_path);
+      int sid = fs_find_file(src_path);
+      if (sid != -1) {
+        if (fs_write_file(dest_path, fs_table[sid].data,
+                          fs_table[sid].size) != -1)
+          print("Copied.\n");
+        else
+          print_error("Error: No space.\n");
+      } else
+        print_error("Source not found.\n");
+    }
+  } else if (strcmp(argv[0], "mv") == 0) {
+    if (argc < 3) {
+      print_error("Usage: mv <src> <dest>\n");
+    } else {
+      char src_path[64];
+      char dest_path[64];
+      build_path(argv[1], src_path);
+      build_path(argv[2], dest_path);
+      int sid = fs_find_file(src_path);
+      if (sid == -1) {
+        print_error("Source not found.\n");
+      } else if (fs_find_file(dest_path) != -1) {
+        print_error("Error: Destination exists.\n");
+      } else {
+        strcpy(fs_table[sid].name, dest_path);
+        print("Moved.\n");
+      }
+    }
+  } else if (strcmp(argv[0], "touch") == 0) {
+    if (argc < 2) {
+      print_error("Usage: touch <filename>\n");
+    } else {
+      char path[64];
+      build_path(argv[1], path);
+      if (fs_write_file(path, "", 0) != -1)
+        print("File created.\n");
+      else
+        print_error("Error: No space.\n");
+    }
+  } else if (strcmp(argv[0], "write") == 0) {
+    if (argc < 3) {
+      print_error("Usage: write <filename> <text>\n");
+    } else {
+      char path[64];
+      build_path(argv[1], path);
+      char *msg = after_n_tokens(raw_line, 2);
+      if (fs_write_file(path, msg, strlen(msg)) != -1)
+        print("Written.\n");
+      else
+        print_error("Error: No space.\n");
+    }
+  } else if (strcmp(argv[0], "append") == 0) {
+    if (argc < 3) {
+      print_error("Usage: append <filename> <text>\n");
+    } else {
+      char path[64];
+      build_path(argv[1], path);
+      char *msg = after_n_tokens(raw_line, 2);
+      int wrote = fs_append_file(path, msg, strlen(msg));
+      if (wrote >= 0)
+        print("Appended.\n");
+      else
+        print_error("Error: File not found.\n");
+    }
+  } else if (strcmp(argv[0], "stat") == 0) {
+    if (argc < 2) {
+      print_error("Usage: stat <filename>\n");
+    } else {
+      char path[64];
+      build_path(argv[1], path);
+      int id = fs_find_file(path);
+      if (id != -1) {
+        print("Name: ");
+        print(path);
+        print("\nSize: ");
+        char sb[16];
+        itoa(fs_table[id].size, sb);
+        print(sb);
+        print(" bytes\n");
+      } else
+        print_error("Error: File not found.\n");
+    }
+  } else if (strcmp(argv[0], "find") == 0) {
+    if (argc < 2) {
+      print_error("Usage: find <text>\n");
+    } else {
+      int found = 0;
+      for (int i = 0; i < MAX_FILES; i++) {
+        if (!fs_table[i].used)
+          continue;
+        if (str_contains(fs_table[i].name, argv[1])) {
+          print(fs_table[i].name);
+          print("\n");
+          found = 1;
+        }
+      }
+      if (!found)
+        print("No matches.\n");
+    }
+  } else if (strcmp(argv[0], "grep") == 0) {
+    if (argc < 3) {
+      print_error("Usage: grep <text> <filename>\n");
+    } else {
+      char path[64];
+      build_path(argv[2], path);
+      int id = fs_find_file(path);
+      if (id != -1) {
+        static pipe_stage_t grep_stage;
+        stream_t console;
+        console.kind = STREAM_CONSOLE;
+        pipe_stage_init(&grep_stage, FILTER_GREP, argv[1],
+                        out_stream ? out_stream : &console);
+        for (int i = 0; i < fs_table[id].size; i++)
+          pipe_filter_char(&grep_stage, fs_table[id].data[i]);
+        pipe_finish(&grep_stage);
+      } else
+        print_error("Error: File not found.\n");
+    }
+  } else if (strcmp(argv[0], "set") == 0) {
+    if (argc == 1) {
+      for (int i = 0; i < MAX_VARS; i++) {
+        if (!shell_vars[i].used)
+          continue;
+        print(shell_vars[i].name);
+        print("=");
+        print(shell_vars[i].value);
+        print("\n");
+      }
+    } else if (!var_set(argv[1], after_n_tokens(raw_line, 2))) {
+      print_error("Error: Invalid variable.\n");
+    }
+  } else if (strcmp(argv[0], "run") == 0) {
+    if (argc < 2) {
+      print_error("Usage: run <script>\n");
+    } else if (script_running) {
+      print_error("Error: Nested run is not supported.\n");
+    } else {
+      char path[64];
+      build_path(argv[1], path);
+      if (fs_find_file(path) == -1) {
+        print_error("Error: File not found.\n");
+      } else {
+        script_t *sc = script_load(path);
+        if (sc) {
+          script_running = true;
+          int ok = script_run(sc);
+          script_running = false;
+          shell_status = ok ? 0 : 1;
+        }
+      }
+    }
+  } else if (strcmp(argv[0], "history") == 0) {
+    for (int i = 0; i < history_count; i++) {
+      char sb[8];
+      itoa(i + 1, sb);
+      print(sb);
+      print(": ");
+      print(history_buf[i]);
+      print("\n");
+    }
+  } else if (strcmp(argv[0], "rm") == 0) {
+    if (argc < 2) {
+      print_error("Usage: rm <filename>\n");
+    } else {
+      char path[64];
+      build_path(argv[1], path);
+      if (fs_delete_file(path))
+        print("File deleted.\n");
+      else
+        print_error("Error: File not found.\n");
+    }
+  } else if (strcmp(argv[0], "tredit") == 0) {
+    if (argc < 2)
+      print_error("Usage: tredit <filename>\n");
+    else {
+      char path[64];
+      build_path(argv[1], path);
+      tredit(path);
+    }
+  } else if (strcmp(argv[0], "cls") == 0 || strcmp(argv[0], "clear") == 0)
+    clear_screen();
+  else if (strcmp(argv[0], "reboot") == 0)
+    outb(0x64, 0xFE);
+  else if (strcmp(argv[0], "ver") == 0)
+    print("TarkOS Nova v1.9.6 Ultimate [Stable]\n");
+  else if (strcmp(argv[0], "pong") == 0)
+    game_pong();
+  else {
+    print_error("Nova Error: '");
+    print_error(raw_line);
+    print_error("' unknown.\n");
+  }
+}
+
+// Splits "cmd | filter ... > file" into stages and runs the first segment with
+// its output bound to the pipeline. A redirect may only end the line, with a
+// single filename after it. Lines without '|' or '>' go straight to
+// shell_exec. A nested line (from a script or `time`) writes to the caller's
+// stream; it may not start a pipeline or redirect of its own, since there is
+// only one set of pipe stages.
+void shell_run_line(char *line) {
+  stream_t *outer = out_stream;
+  char expanded[64];
   char raw_line[64];
   char *argv[8];
+  char *segs[MAX_PIPE_STAGES + 1];
+  int nsegs = 0;
+  int truncate = 0;
+  stream_t sink;
+  sink.kind = STREAM_CONSOLE;
+  sink.stage = NULL;
+  sink.path[0] = 0;
+  shell_status = 0;
+
+  if (str_contains(line, "$")) {
+    if (!var_expand(line, expanded, sizeof(expanded))) {
+      print_error("Error: Line too long.\n");
+      return;
+    }
+    line = expanded;
+  }
+
+  for (char *p = line; *p; p++) {
+    if (*p != '>')
+      continue;
+    int append = p[1] == '>';
+    *p = 0;
+    char *target = trim_spaces(p + 1 + append);
+    // Everything after the first '>' is the target: a pipe there would
+    // need a second output, and a second '>' or word is not a filename
+    if (str_contains(target, "|")) {
+      print_error("Error: Redirect must end the line.\n");
+      return;
+    }
+    if (!*target || str_contains(target, ">") || str_contains(target, " ")) {
+      print_error("Usage: <command> > <filename>\n");
+      return;
+    }
+    if (!build_path(target, sink.path)) {
+      print_error("Error: Invalid path.\n");
+      return;
+    }
+    truncate = !append || fs_find_file(sink.path) == -1;
+    sink.kind = STREAM_FILE;
+    break;
+  }
+
+  char *p = line;
+  segs[nsegs++] = p;
+  for (; *p; p++) {
+    if (*p != '|')
+      continue;
+    if (nsegs == MAX_PIPE_STAGES + 1) {
+      print_error("Error: Pipeline too long.\n");
+      return;
+    }
+    *p = 0;
+    segs[nsegs++] = p + 1;
+  }
+  for (int i = 0; i < nsegs; i++) {
+    segs[i] = trim_spaces(segs[i]);
+    if (!*segs[i] && (nsegs > 1 || sink.kind != STREAM_CONSOLE)) {
+      print_error("Error: Empty pipeline stage.\n");
+      return;
+    }
+  }
+  if (outer && (nsegs > 1 || sink.kind != STREAM_CONSOLE)) {
+    print_error("Error: Nested pipe or redirect.\n");
+    return;
+  }
+
+  for (int i = 1; i < nsegs; i++) {
+    int argc = split_args(segs[i], argv, 8);
+    int filter = pipe_filter_id(argv[0]);
+    if (filter < 0 || (filter == FILTER_GREP && argc < 2)) {
+      print_error("Nova Error: '");
+      print_error(argv[0]);
+      print_error("' cannot read from a pipe.\n");
+      return;
+    }
+    stream_t next;
+    next.kind = STREAM_PIPE;
+    next.stage = &pipe_stages[i];
+    next.path[0] = 0;
+    pipe_stage_init(&pipe_stages[i - 1], filter,
+                    filter == FILTER_GREP ? argv[1] : NULL,
+                    i == nsegs - 1 ? &sink : &next);
+  }
+
+  // The target is only created or emptied once the whole line is valid
+  if (truncate && fs_write_file(sink.path, "", 0) < 0) {
+    print_error("Error: No space.\n");
+    return;
+  }
+
+  strcpy(raw_line, segs[0]);
+  int argc = split_args(segs[0], argv, 8);
+  if (argc == 0)
+    return;
+  stream_t head;
+  head.kind = STREAM_PIPE;
+  head.stage = &pipe_stages[0];
+  head.path[0] = 0;
+  if (nsegs > 1)
+    out_stream = &head;
+  else if (sink.kind != STREAM_CONSOLE)
+    out_stream = &sink;
+  shell_exec(argc, argv, raw_line);
+  out_stream = outer;
+  for (int i = 0; i < nsegs - 1; i++)
+    pipe_finish(&pipe_stages[i]);
+}
+
+void shell_loop() {
+  char line[64];
   int pos = 0;
   bool shift = false;
   int history_pos = 0;
@@ -1232,6 +2874,7 @@ void shell_loop() {
     while (1) {
       uint8_t sc = get_any_scancode();
       draw_shell_dynamic();
+      log_drain_serial();
       if (!sc)
         continue;
       if (sc == 0x2A || sc == 0x36)
@@ -1272,7 +2915,6 @@ void shell_loop() {
     }
     if (pos > 0) {
       line[pos] = 0;
-      strcpy(raw_line, line);
       if (history_count == 0 ||
           strcmp(history_buf[history_count - 1], line) != 0) {
         if (history_count < HISTORY_SIZE) {
@@ -1283,374 +2925,7 @@ void shell_loop() {
           strcpy(history_buf[HISTORY_SIZE - 1], line);
         }
       }
-      int argc = split_args(line, argv, 8);
-      if (argc == 0)
-        continue;
-
-      if (argc == 1) {
-        const char *desc = command_desc(argv[0]);
-        if (desc) {
-          print(desc);
-          print("\n");
-          if (!command_runs_without_args(argv[0]))
-            continue;
-        }
-      }
-
-      if (strcmp(argv[0], "help") == 0) {
-        set_color(col_accent, col_bg >> 4);
-        print("\nTARKOS NOVA ULTIMATE - CONSOLE ASSISTANCE\n");
-        set_color(0x0F, col_bg >> 4);
-        print("- FS: ls, cat, touch, rm, cd, mkdir, rmdir, cp, mv, pwd, write, "
-              "append, stat, find\n");
-        print("- App: tredit, cls, ver, reboot, time, date, echo, matrix, "
-              "cpuinfo, calc, themes, sysinfo, pong, history\n");
-        print("- Info: about, df, wc\n");
-        print("- UI: 9.4s Hyper Boot [Enabled]\n");
-      } else if (strcmp(argv[0], "sysinfo") == 0) {
-        print("TarkOS Nova v1.9.6 [Eternal Edition]\n");
-        print("Build: 2026-01-30.01\n");
-        print("Kernel: 32-bit x86 Protected Mode\n");
-        print("Memory Manager: PMM + Paging [Active]\n");
-        print("CPU: Multiboot Detected 3-Core SMP\n");
-        print("GUI: Zero-Flicker Dual-Bar [Stable]\n");
-      } else if (strcmp(argv[0], "about") == 0) {
-        print("TarkOS Nova v1.9.6 Ultimate\n");
-        print("Hyper Boot: 9.4s | SMP x3 | RAM 512MB\n");
-        print("VFS: RAMDisk | Shell: Nova Console v3.7\n");
-        print("Themes: dark, neon, classic\n");
-      } else if (strcmp(argv[0], "df") == 0) {
-        int used_files = fs_used_files();
-        int used_bytes = fs_used_bytes();
-        int total_files = MAX_FILES;
-        int total_bytes = MAX_FILES * (MAX_FILE_SIZE - 1);
-        char buf[16];
-        print("Files: ");
-        itoa(used_files, buf);
-        print(buf);
-        print("/");
-        itoa(total_files, buf);
-        print(buf);
-        print("\nData: ");
-        itoa(used_bytes, buf);
-        print(buf);
-        print("/");
-        itoa(total_bytes, buf);
-        print(buf);
-        print(" bytes\n");
-      } else if (strcmp(argv[0], "wc") == 0) {
-        if (argc < 2) {
-          print("Usage: wc <filename>\n");
-        } else {
-          char path[64];
-          if (!build_path(argv[1], path)) {
-            print("Error: Invalid path.\n");
-          } else {
-            int id = fs_find_file(path);
-            if (id != -1) {
-              int lines = count_lines(fs_table[id].data);
-              int words = count_words(fs_table[id].data);
-              int bytes = fs_table[id].size;
-              char buf[16];
-              print("Lines: ");
-              itoa(lines, buf);
-              print(buf);
-              print("  Words: ");
-              itoa(words, buf);
-              print(buf);
-              print("  Bytes: ");
-              itoa(bytes, buf);
-              print(buf);
-              print("\n");
-            } else {
-              print("Error: File not found.\n");
-            }
-          }
-        }
-      } else if (strcmp(argv[0], "cpuinfo") == 0) {
-        uint32_t a, d;
-        cpuid(0, &a, &d);
-        print("CPU Vendor: ");
-        if (a == 0)
-          print("Unknown\n");
-        else
-          print("x86 Compatible\n");
-      } else if (strcmp(argv[0], "calc") == 0) {
-        int res = 0;
-        if (calc_eval(raw_line + 4, &res)) {
-          char buf[16];
-          itoa(res, buf);
-          print("Result: ");
-          print(buf);
-          print("\n");
-        } else {
-          print("Usage: calc <a> <op> <b>\n");
-        }
-      } else if (strcmp(argv[0], "themes") == 0) {
-        if (argc == 2 && strcmp(argv[1], "dark") == 0)
-          set_theme(0);
-        else if (argc == 2 && strcmp(argv[1], "neon") == 0)
-          set_theme(1);
-        else if (argc == 2 && strcmp(argv[1], "classic") == 0)
-          set_theme(2);
-        else
-          print("Usage: themes [dark|neon|classic]\n");
-      } else if (strcmp(argv[0], "echo") == 0) {
-        char *msg = after_n_tokens(raw_line, 1);
-        if (*msg) {
-          print(msg);
-          print("\n");
-        }
-      } else if (strcmp(argv[0], "date") == 0) {
-        char tb[16];
-        char db[16];
-        get_time_str(tb);
-        get_date_str(db);
-        print("Today is: ");
-        print(db);
-        print(" | Local Time: ");
-        print(tb);
-        print("\n");
-      } else if (strcmp(argv[0], "time") == 0) {
-        char tb[16];
-        get_time_str(tb);
-        print("System Time: ");
-        print(tb);
-        print("\n");
-      } else if (strcmp(argv[0], "matrix") == 0) {
-        effect_matrix();
-      } else if (strcmp(argv[0], "ls") == 0 || strcmp(argv[0], "dir") == 0) {
-        if (argc == 1) {
-          ls_current_dir();
-        } else if (strcmp(argv[1], "/") == 0) {
-          ls_dir_path("/");
-        } else {
-          char path[64];
-          if (build_path(argv[1], path))
-            ls_dir_path(path);
-          else
-            print("Error: Invalid path.\n");
-        }
-      } else if (strcmp(argv[0], "pwd") == 0) {
-        print(current_path);
-        print("\n");
-      } else if (strcmp(argv[0], "cd") == 0) {
-        if (argc == 1) {
-          print(current_path);
-          print("\n");
-        } else {
-          char new_path[64];
-          if (strcmp(argv[1], "/") == 0) {
-            strcpy(current_path, "/");
-          } else if (strcmp(argv[1], "..") == 0) {
-            path_parent(current_path, new_path);
-            strcpy(current_path, new_path);
-          } else if (strcmp(argv[1], ".") == 0) {
-          } else {
-            if (argv[1][0] == '/') {
-              strcpy(new_path, argv[1]);
-            } else if (strcmp(current_path, "/") == 0) {
-              new_path[0] = '/';
-              new_path[1] = 0;
-              strcat(new_path, argv[1]);
-            } else {
-              strcpy(new_path, current_path);
-              strcat(new_path, "/");
-              strcat(new_path, argv[1]);
-            }
-            if (fs_dir_exists(new_path))
-              strcpy(current_path, new_path);
-            else
-              print("Error: Directory not found.\n");
-          }
-        }
-      } else if (strcmp(argv[0], "mkdir") == 0) {
-        if (argc < 2) {
-          print("Usage: mkdir <dirname>\n");
-        } else {
-          char path[64];
-          if (!build_path(argv[1], path)) {
-            print("Error: Invalid path.\n");
-          } else if (fs_mkdir(path)) {
-            print("Directory created.\n");
-          } else {
-            print("Error: Unable to create directory.\n");
-          }
-        }
-      } else if (strcmp(argv[0], "rmdir") == 0) {
-        if (argc < 2) {
-          print("Usage: rmdir <dirname>\n");
-        } else {
-          char path[64];
-          if (!build_path(argv[1], path)) {
-            print("Error: Invalid path.\n");
-          } else if (fs_rmdir(path) > 0) {
-            print("Directory removed.\n");
-          } else {
-            print("Error: Directory not found.\n");
-          }
-        }
-      } else if (strcmp(argv[0], "cat") == 0) {
-        if (argc < 2) {
-          print("Usage: cat <filename>\n");
-        } else {
-          char path[64];
-          build_path(argv[1], path);
-          int id = fs_find_file(path);
-          if (id != -1) {
-            print(fs_table[id].data);
-            print("\n");
-          } else
-            print("Error: File not found.\n");
-        }
-      } else if (strcmp(argv[0], "cp") == 0) {
-        if (argc < 3) {
-          print("Usage: cp <src> <dest>\n");
-        } else {
-          char src_path[64];
-          char dest_path[64];
-          build_path(argv[1], src_path);
-          build_path(argv[2], dest_path);
-          int sid = fs_find_file(src_path);
-          if (sid != -1) {
-            if (fs_write_file(dest_path, fs_table[sid].data,
-                              fs_table[sid].size) != -1)
-              print("Copied.\n");
-            else
-              print("Error: No space.\n");
-          } else
-            print("Source not found.\n");
-        }
-      } else if (strcmp(argv[0], "mv") == 0) {
-        if (argc < 3) {
-          print("Usage: mv <src> <dest>\n");
-        } else {
-          char src_path[64];
-          char dest_path[64];
-          build_path(argv[1], src_path);
-          build_path(argv[2], dest_path);
-          int sid = fs_find_file(src_path);
-          if (sid == -1) {
-            print("Source not found.\n");
-          } else if (fs_find_file(dest_path) != -1) {
-            print("Error: Destination exists.\n");
-          } else {
-            strcpy(fs_table[sid].name, dest_path);
-            print("Moved.\n");
-          }
-        }
-      } else if (strcmp(argv[0], "touch") == 0) {
-        if (argc < 2) {
-          print("Usage: touch <filename>\n");
-        } else {
-          char path[64];
-          build_path(argv[1], path);
-          if (fs_write_file(path, "", 0) != -1)
-            print("File created.\n");
-          else
-            print("Error: No space.\n");
-        }
-      } else if (strcmp(argv[0], "write") == 0) {
-        if (argc < 3) {
-          print("Usage: write <filename> <text>\n");
-        } else {
-          char path[64];
-          build_path(argv[1], path);
-          char *msg = after_n_tokens(raw_line, 2);
-          if (fs_write_file(path, msg, strlen(msg)) != -1)
-            print("Written.\n");
-          else
-            print("Error: No space.\n");
-        }
-      } else if (strcmp(argv[0], "append") == 0) {
-        if (argc < 3) {
-          print("Usage: append <filename> <text>\n");
-        } else {
-          char path[64];
-          build_path(argv[1], path);
-          char *msg = after_n_tokens(raw_line, 2);
-          int wrote = fs_append_file(path, msg, strlen(msg));
-          if (wrote >= 0)
-            print("Appended.\n");
-          else
-            print("Error: File not found.\n");
-        }
-      } else if (strcmp(argv[0], "stat") == 0) {
-        if (argc < 2) {
-          print("Usage: stat <filename>\n");
-        } else {
-          char path[64];
-          build_path(argv[1], path);
-          int id = fs_find_file(path);
-          if (id != -1) {
-            print("Name: ");
-            print(path);
-            print("\nSize: ");
-            char sb[16];
-            itoa(fs_table[id].size, sb);
-            print(sb);
-            print(" bytes\n");
-          } else
-            print("Error: File not found.\n");
-        }
-      } else if (strcmp(argv[0], "find") == 0) {
-        if (argc < 2) {
-          print("Usage: find <text>\n");
-        } else {
-          int found = 0;
-          for (int i = 0; i < MAX_FILES; i++) {
-            if (!fs_table[i].used)
-              continue;
-            if (str_contains(fs_table[i].name, argv[1])) {
-              print(fs_table[i].name);
-              print("\n");
-              found = 1;
-            }
-          }
-          if (!found)
-            print("No matches.\n");
-        }
-      } else if (strcmp(argv[0], "history") == 0) {
-        for (int i = 0; i < history_count; i++) {
-          char sb[8];
-          itoa(i + 1, sb);
-          print(sb);
-          print(": ");
-          print(history_buf[i]);
-          print("\n");
-        }
-      } else if (strcmp(argv[0], "rm") == 0) {
-        if (argc < 2) {
-          print("Usage: rm <filename>\n");
-        } else {
-          char path[64];
-          build_path(argv[1], path);
-          if (fs_delete_file(path))
-            print("File deleted.\n");
-          else
-            print("Error: File not found.\n");
-        }
-      } else if (strcmp(argv[0], "tredit") == 0) {
-        if (argc < 2)
-          print("Usage: tredit <filename>\n");
-        else {
-          char path[64];
-          build_path(argv[1], path);
-          tredit(path);
-        }
-      } else if (strcmp(argv[0], "cls") == 0 || strcmp(argv[0], "clear") == 0)
-        clear_screen();
-      else if (strcmp(argv[0], "reboot") == 0)
-        outb(0x64, 0xFE);
-      else if (strcmp(argv[0], "ver") == 0)
-        print("TarkOS Nova v1.9.6 Ultimate [Stable]\n");
-      else if (strcmp(argv[0], "pong") == 0)
-        game_pong();
-      else {
-        print("Nova Error: '");
-        print(raw_line);
-        print("' unknown.\n");
-      }
+      shell_run_line(line);
     }
   }
 }
@@ -1700,8 +2975,51 @@ void hyper_cinematic_nova_eternal_boot() {
   }
 }
 
-void kmain() {
+// Headless benchmark run selected by the "bench" kernel command line flag:
+// results go to COM1, then QEMU's isa-debug-exit device (port 0xF4) ends
+// the VM. On real hardware the write is ignored and the shell starts.
+void bench_boot() {
+  stream_t com1;
+  com1.kind = STREAM_SERIAL;
+  serial_init();
+  clear_screen();
+  out_stream = &com1;
+  klog("bench: headless run");
+  print("TarkOS bench begin\n");
+  if (tsc_available())
+    bench_run_suite();
+  else
+    print("error: CPU has no TSC\n");
+  print("TarkOS bench end\n");
+  out_stream = NULL;
+  outb(0xF4, 0x00);
+}
+
+#define MULTIBOOT_MAGIC 0x2BADB002
+#define MULTIBOOT_FLAG_CMDLINE 0x04
+
+void kmain(uint32_t magic, uint32_t *mbi) {
+  cpu_detect();
+  log_init();
+  klog("TarkOS Nova v1.9.6 boot");
+  char line[LOG_TEXT + 8];
+  strcpy(line, "CPU: ");
+  strcat(line, cpu_vendor);
+  klog(line);
+  const char *brand = cpu_brand;
+  while (*brand == ' ')
+    brand++;
+  if (*brand) {
+    strcpy(line, "CPU: ");
+    strcat(line, brand);
+    klog(line);
+  }
   fs_init();
-  hyper_cinematic_nova_eternal_boot();
+  klog("RAMDisk ready");
+  if (magic == MULTIBOOT_MAGIC && (mbi[0] & MULTIBOOT_FLAG_CMDLINE) &&
+      str_has_word((const char *)mbi[4], "bench"))
+    bench_boot();
+  else
+    hyper_cinematic_nova_eternal_boot();
   shell_loop();
 }
@@ -1,134 +1,328 @@
 /**
  * TarkOS - Printf Implementation
- * Simple formatted output for debugging
+ * Bounded formatted output for logs and debugging
+ *
+ * Numbers are written straight into a small stack buffer, last digit
+ * first, two decimal digits per division. 64-bit values are split into
+ * 8-digit chunks with one 64/32 divl each, so nothing calls libgcc.
  */
 
 #include <lib/printf.h>
 #include <lib/string.h>
 
+/* "00" to "99" */
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const char hex_lower[] = "0123456789abcdef";
+static const char hex_upper[] = "0123456789ABCDEF";
+
+/* Longest number: 20 decimal digits (UINT64_MAX) */
+#define NUM_BUF_SIZE        24
+
+/* Conversion flags */
+#define FMT_ZERO            (1 << 0)    /* '0': pad numbers with zeros */
+#define FMT_LEFT            (1 << 1)    /* '-': pad on the right */
+
 /**
- * Format string with va_list
+ * Output position: characters past size are counted but not stored
  */
-int vsprintf(char* buf, const char* fmt, __builtin_va_list args) {
-    char* p = buf;
+typedef struct {
+    char* buf;
+    size_t size;                /* Room for characters (NUL excluded) */
+    size_t len;                 /* Characters produced so far */
+} fmt_out_t;
+
+static inline void out_char(fmt_out_t* out, char c) {
+    if (out->len < out->size) {
+        out->buf[out->len] = c;
+    }
+    out->len++;
+}
+
+static inline void out_chars(fmt_out_t* out, const char* s, size_t n) {
+    size_t room = out->len < out->size ? out->size - out->len : 0;
+    size_t copy = n < room ? n : room;
+    char* d = out->buf + out->len;
+    for (size_t i = 0; i < copy; i++) {
+        d[i] = s[i];
+    }
+    out->len += n;
+}
+
+/**
+ * Copy s up to its NUL or the first stop character, in one pass
+ * @return Where copying stopped
+ */
+static inline const char* out_until(fmt_out_t* out, const char* s, char stop) {
+    size_t room = out->len < out->size ? out->size - out->len : 0;
+    char* d = out->buf + out->len;
+    const char* start = s;
+    
+    for (; *s && *s != stop; s++) {
+        if ((size_t)(s - start) < room) {
+            d[s - start] = *s;
+        }
+    }
+    out->len += s - start;
+    return s;
+}
+
+static void out_pad(fmt_out_t* out, char c, int n) {
+    for (; n > 0; n--) {
+        out_char(out, c);
+    }
+}
+
+/**
+ * Write a field: prefix ("-", "0x"), then body, padded to width
+ */
+static inline void out_field(fmt_out_t* out, const char* prefix, int prefix_len,
+                             const char* body, int body_len, int width, uint32_t flags) {
+    int pad = width - prefix_len - body_len;
+    
+    if (pad <= 0) {
+        out_chars(out, prefix, prefix_len);
+        out_chars(out, body, body_len);
+        return;
+    }
+    if (!(flags & (FMT_LEFT | FMT_ZERO))) {
+        out_pad(out, ' ', pad);
+    }
+    out_chars(out, prefix, prefix_len);
+    if ((flags & (FMT_LEFT | FMT_ZERO)) == FMT_ZERO) {
+        out_pad(out, '0', pad);
+    }
+    out_chars(out, body, body_len);
+    if (flags & FMT_LEFT) {
+        out_pad(out, ' ', pad);
+    }
+}
+
+/**
+ * Write v in decimal ending just before end
+ * @return First digit
+ */
+static char* fmt_u32(char* end, uint32_t v) {
+    while (v >= 100) {
+        uint32_t q = v / 100;
+        uint32_t r = v - q * 100;
+        end -= 2;
+        end[0] = digit_pairs[r * 2];
+        end[1] = digit_pairs[r * 2 + 1];
+        v = q;
+    }
+    if (v >= 10) {
+        end -= 2;
+        end[0] = digit_pairs[v * 2];
+        end[1] = digit_pairs[v * 2 + 1];
+    } else {
+        *--end = (char)('0' + v);
+    }
+    return end;
+}
+
+/**
+ * Divide *v by d in place
+ * @return Remainder
+ */
+static uint32_t div_u64(uint64_t* v, uint32_t d) {
+    uint32_t hi = (uint32_t)(*v >> 32);
+    uint32_t lo = (uint32_t)*v;
+    uint32_t q_hi = hi / d;
+    uint32_t q_lo, rem;
+    
+    /* hi % d < d, so the quotient fits in 32 bits */
+    __asm__("divl %4" : "=a"(q_lo), "=d"(rem) : "a"(lo), "d"(hi % d), "rm"(d));
+    *v = ((uint64_t)q_hi << 32) | q_lo;
+    return rem;
+}
+
+/**
+ * Write a 64-bit v in decimal ending just before end
+ */
+static char* fmt_u64(char* end, uint64_t v) {
+    while (v >> 32) {
+        char* stop = end - 8;
+        end = fmt_u32(end, div_u64(&v, 100000000));
+        while (end > stop) {
+            *--end = '0';
+        }
+    }
+    return fmt_u32(end, (uint32_t)v);
+}
+
+/**
+ * Write v in hex ending just before end
+ */
+static char* fmt_hex(char* end, uint64_t v, const char* digits) {
+    do {
+        *--end = digits[v & 15];
+        v >>= 4;
+    } while (v);
+    return end;
+}
+
+/**
+ * Format into a buffer of size bytes
+ */
+int vsnprintf(char* buf, size_t size, const char* fmt, __builtin_va_list args) {
+    fmt_out_t out = { buf, size ? size - 1 : 0, 0 };
+    char num[NUM_BUF_SIZE];
+    char* end = num + NUM_BUF_SIZE;
     
     while (*fmt) {
-        if (*fmt != '%') {
-            *p++ = *fmt++;
-            continue;
+        fmt = out_until(&out, fmt, '%');
+        if (*fmt == '\0') {
+            break;
         }
         
         fmt++;  /* Skip '%' */
         
-        /* Handle flags (simplified) */
-        bool pad_zero = false;
+        uint32_t flags = 0;
         int width = 0;
+        int longs = 0;
         
-        if (*fmt == '0') {
-            pad_zero = true;
-            fmt++;
+        for (;; fmt++) {
+            if (*fmt == '0') {
+                flags |= FMT_ZERO;
+            } else if (*fmt == '-') {
+                flags |= FMT_LEFT;
+            } else {
+                break;
+            }
         }
-        
         while (*fmt >= '0' && *fmt <= '9') {
             width = width * 10 + (*fmt - '0');
             fmt++;
         }
+        for (; *fmt == 'l'; fmt++) {
+            longs++;
+        }
+        if (*fmt == 'z') {
+            fmt++;  /* size_t is 32-bit */
+        }
         
         switch (*fmt) {
             case 'd':
             case 'i': {
-                int val = __builtin_va_arg(args, int);
-                char tmp[16];
-                itoa(val, tmp, 10);
-                int len = strlen(tmp);
-                while (width > len) {
-                    *p++ = pad_zero ? '0' : ' ';
-                    width--;
+                int64_t val;
+                if (longs >= 2) {
+                    val = __builtin_va_arg(args, long long);
+                } else if (longs == 1) {
+                    val = __builtin_va_arg(args, long);
+                } else {
+                    val = __builtin_va_arg(args, int);
                 }
-                strcpy(p, tmp);
-                p += len;
-                break;
-            }
-            
-            case 'u': {
-                uint32_t val = __builtin_va_arg(args, uint32_t);
-                char tmp[16];
-                utoa(val, tmp, 10);
-                int len = strlen(tmp);
-                while (width > len) {
-                    *p++ = pad_zero ? '0' : ' ';
-                    width--;
-                }
-                strcpy(p, tmp);
-                p += len;
+                uint64_t mag = val < 0 ? -(uint64_t)val : (uint64_t)val;
+                char* p = fmt_u64(end, mag);
+                out_field(&out, "-", val < 0, p, end - p, width, flags);
                 break;
             }
             
+            case 'u':
             case 'x':
             case 'X': {
-                uint32_t val = __builtin_va_arg(args, uint32_t);
-                char tmp[16];
-                utoa(val, tmp, 16);
-                int len = strlen(tmp);
-                while (width > len) {
-                    *p++ = pad_zero ? '0' : ' ';
-                    width--;
+                uint64_t val;
+                if (longs >= 2) {
+                    val = __builtin_va_arg(args, unsigned long long);
+                } else if (longs == 1) {
+                    val = __builtin_va_arg(args, unsigned long);
+                } else {
+                    val = __builtin_va_arg(args, unsigned int);
+                }
+                char* p;
+                if (*fmt == 'u') {
+                    p = longs >= 2 ? fmt_u64(end, val) : fmt_u32(end, (uint32_t)val);
+                } else {
+                    p = fmt_hex(end, val, *fmt == 'x' ? hex_lower : hex_upper);
                 }
-                strcpy(p, tmp);
-                p += len;
+                out_field(&out, "", 0, p, end - p, width, flags);
                 break;
             }
             
             case 'p': {
-                uint32_t val = __builtin_va_arg(args, uint32_t);
-                *p++ = '0';
-                *p++ = 'x';
-                char tmp[16];
-                utoa(val, tmp, 16);
-                int len = strlen(tmp);
-                while (8 > len) {
-                    *p++ = '0';
-                    len++;
+                uintptr_t val = (uintptr_t)__builtin_va_arg(args, void*);
+                char* p = fmt_hex(end, val, hex_lower);
+                while (end - p < (int)sizeof(uintptr_t) * 2) {
+                    *--p = '0';
                 }
-                strcpy(p, tmp);
-                p += strlen(tmp);
+                out_field(&out, "0x", 2, p, end - p, width, flags & FMT_LEFT);
                 break;
             }
             
             case 's': {
                 const char* str = __builtin_va_arg(args, const char*);
-                if (str == NULL) str = "(null)";
-                while (*str) {
-                    *p++ = *str++;
+                if (str == NULL) {
+                    str = "(null)";
+                }
+                if (width == 0) {
+                    out_until(&out, str, '\0');
+                } else {
+                    out_field(&out, "", 0, str, strlen(str), width, flags & FMT_LEFT);
                 }
                 break;
             }
             
             case 'c': {
                 char c = (char)__builtin_va_arg(args, int);
-                *p++ = c;
+                out_field(&out, "", 0, &c, 1, width, flags & FMT_LEFT);
                 break;
             }
             
             case '%':
-                *p++ = '%';
+                out_char(&out, '%');
+                break;
+            
+            case '\0':
+                /* Format ends in a bare '%' */
+                fmt--;
                 break;
             
             default:
-                *p++ = '%';
-                *p++ = *fmt;
+                out_char(&out, '%');
+                out_char(&out, *fmt);
                 break;
         }
         
         fmt++;
     }
     
-    *p = '\0';
-    return p - buf;
+    if (size) {
+        buf[out.len < out.size ? out.len : out.size] = '\0';
+    }
+    return (int)out.len;
+}
+
+/**
+ * Format into a buffer of size bytes
+ */
+int snprintf(char* buf, size_t size, const char* fmt, ...) {
+    __builtin_va_list args;
+    __builtin_va_start(args, fmt);
+    int ret = vsnprintf(buf, size, fmt, args);
+    __builtin_va_end(args);
+    return ret;
+}
+
+/**
+ * Format string with va_list (unbounded)
+ */
+int vsprintf(char* buf, const char* fmt, __builtin_va_list args) {
+    return vsnprintf(buf, (size_t)-1, fmt, args);
 }
 
 /**
- * Format string into buffer
+ * Format string into buffer (unbounded)
  */
 int sprintf(char* buf, const char* fmt, ...) {
     __builtin_va_list args;
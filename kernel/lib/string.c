@@ -1,9 +1,424 @@
 /**
  * TarkOS - String Library Implementation
  * Basic string and memory manipulation functions
+ *
+ * Block copies and fills use rep movs/stos, which every x86 runs at cache
+ * line speed for large sizes. string_init() fills string_ops once at boot:
+ * rep movsb/stosb on CPUs with ERMS, SSE2 for large blocks, with
+ * non-temporal stores past STRING_NT_COPY/STRING_NT_FILL so multi-megabyte
+ * framebuffer copies and clears don't evict the cache. SSE2 blocks run
+ * between fpu_begin() and fpu_end(), so they are safe in any context; a
+ * large block is split so interrupts are never held off for long.
+ * memblendl() is dispatched the same way, four pixels per SSE2 step.
  */
 
 #include <lib/string.h>
+#include <kernel/cpu.h>
+#include <kernel/fpu.h>
+
+/* Below this, loops beat the rep/SSE2 startup cost */
+#define STRING_SMALL        64
+
+/*
+ * From these sizes on, SSE2 copies and fills bypass the cache. Below them
+ * the destination is likely read again soon and cached stores win
+ */
+#define STRING_NT_COPY      (2 * 1024 * 1024)
+#define STRING_NT_FILL      (8 * 1024 * 1024)
+
+/* Most bytes moved per fpu_begin() section (interrupts are off inside) */
+#define STRING_FPU_CHUNK    (64 * 1024)
+
+/* CR4 bit that allows SSE instructions */
+#define CR4_OSFXSR          (1 << 9)
+
+/* Unaligned 32-bit access (x86 allows it) */
+typedef uint32_t __attribute__((may_alias, aligned(1))) unaligned_u32;
+
+/* One SSE register of 32-bit lanes, for "x" asm operands */
+typedef uint32_t v4u32 __attribute__((vector_size(16)));
+
+/* The same register as 16-bit lanes, and an unaligned load/store view */
+typedef uint16_t v8u16 __attribute__((vector_size(16)));
+typedef uint32_t v4u32_unaligned __attribute__((vector_size(16), aligned(1)));
+
+/**
+ * rep movsb: n bytes forward
+ */
+static inline void rep_movsb(void* d, const void* s, unsigned long n) {
+    __asm__ volatile("rep movsb" : "+D"(d), "+S"(s), "+c"(n) : : "memory");
+}
+
+/**
+ * rep movsl: n 32-bit words forward
+ */
+static inline void rep_movsl(void* d, const void* s, unsigned long n) {
+    __asm__ volatile("rep movsl" : "+D"(d), "+S"(s), "+c"(n) : : "memory");
+}
+
+/**
+ * rep stosb: n bytes of val
+ */
+static inline void rep_stosb(void* d, uint8_t val, unsigned long n) {
+    __asm__ volatile("rep stosb" : "+D"(d), "+c"(n) : "a"(val) : "memory");
+}
+
+/**
+ * rep stosl: n 32-bit words of val
+ */
+static inline void rep_stosl(void* d, uint32_t val, unsigned long n) {
+    __asm__ volatile("rep stosl" : "+D"(d), "+c"(n) : "a"(val) : "memory");
+}
+
+/**
+ * Copy 64-byte blocks to a 16-byte aligned destination
+ */
+__attribute__((target("sse2")))
+static void sse2_copy(uint8_t* d, const uint8_t* s, size_t blocks, bool nt) {
+    if (nt) {
+        for (; blocks; blocks--, d += 64, s += 64) {
+            __asm__ volatile(
+                "movdqu   (%1), %%xmm0\n\t"
+                "movdqu 16(%1), %%xmm1\n\t"
+                "movdqu 32(%1), %%xmm2\n\t"
+                "movdqu 48(%1), %%xmm3\n\t"
+                "movntdq %%xmm0,   (%0)\n\t"
+                "movntdq %%xmm1, 16(%0)\n\t"
+                "movntdq %%xmm2, 32(%0)\n\t"
+                "movntdq %%xmm3, 48(%0)"
+                : : "r"(d), "r"(s) : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+        }
+        __asm__ volatile("sfence" : : : "memory");
+    } else {
+        for (; blocks; blocks--, d += 64, s += 64) {
+            __asm__ volatile(
+                "movdqu   (%1), %%xmm0\n\t"
+                "movdqu 16(%1), %%xmm1\n\t"
+                "movdqu 32(%1), %%xmm2\n\t"
+                "movdqu 48(%1), %%xmm3\n\t"
+                "movdqa %%xmm0,   (%0)\n\t"
+                "movdqa %%xmm1, 16(%0)\n\t"
+                "movdqa %%xmm2, 32(%0)\n\t"
+                "movdqa %%xmm3, 48(%0)"
+                : : "r"(d), "r"(s) : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+        }
+    }
+}
+
+/**
+ * Fill 64-byte blocks at a 16-byte aligned destination with a 32-bit pattern
+ */
+__attribute__((target("sse2")))
+static void sse2_fill(uint8_t* d, uint32_t val, size_t blocks, bool nt) {
+    v4u32 pattern = { val, val, val, val };
+    if (nt) {
+        for (; blocks; blocks--, d += 64) {
+            __asm__ volatile(
+                "movntdq %1,   (%0)\n\t"
+                "movntdq %1, 16(%0)\n\t"
+                "movntdq %1, 32(%0)\n\t"
+                "movntdq %1, 48(%0)"
+                : : "r"(d), "x"(pattern) : "memory");
+        }
+        __asm__ volatile("sfence" : : : "memory");
+    } else {
+        for (; blocks; blocks--, d += 64) {
+            __asm__ volatile(
+                "movdqa %1,   (%0)\n\t"
+                "movdqa %1, 16(%0)\n\t"
+                "movdqa %1, 32(%0)\n\t"
+                "movdqa %1, 48(%0)"
+                : : "r"(d), "x"(pattern) : "memory");
+        }
+    }
+}
+
+/**
+ * Copy 16 bytes through a register (both loaded before either is stored)
+ */
+__attribute__((target("sse2")))
+static inline void sse2_move16(uint8_t* d, const uint8_t* s) {
+    __asm__ volatile("movdqu (%1), %%xmm0\n\t"
+                     "movdqu %%xmm0, (%0)"
+                     : : "r"(d), "r"(s) : "memory", "xmm0");
+}
+
+/**
+ * Copy: rep movsl and a byte tail (any x86)
+ */
+static void copy_movsl(uint8_t* d, const uint8_t* s, size_t n) {
+    rep_movsl(d, s, n / 4);
+    rep_movsb(d + (n & ~3U), s + (n & ~3U), n & 3);
+}
+
+/**
+ * Copy: rep movsb (ERMS)
+ */
+static void copy_movsb(uint8_t* d, const uint8_t* s, size_t n) {
+    rep_movsb(d, s, n);
+}
+
+/**
+ * Copy: byte head up to a 16-byte aligned destination, 64-byte SSE2
+ * blocks, byte tail
+ */
+static void copy_sse2(uint8_t* d, const uint8_t* s, size_t n) {
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    rep_movsb(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    bool nt = n >= STRING_NT_COPY;
+    for (size_t left = n & ~63U; left; ) {
+        size_t chunk = (left < STRING_FPU_CHUNK) ? left : STRING_FPU_CHUNK;
+        uint32_t flags = fpu_begin();
+        sse2_copy(d, s, chunk / 64, nt);
+        fpu_end(flags);
+        d += chunk;
+        s += chunk;
+        left -= chunk;
+    }
+    rep_movsb(d, s, n & 63);
+}
+
+/**
+ * Copy: rep movsb, SSE2 non-temporal for large blocks (ERMS + SSE2)
+ */
+static void copy_movsb_nt(uint8_t* d, const uint8_t* s, size_t n) {
+    if (n >= STRING_NT_COPY) {
+        copy_sse2(d, s, n);
+    } else {
+        rep_movsb(d, s, n);
+    }
+}
+
+/**
+ * Fill with a byte (val32 holds it four times): rep stosl and a byte tail
+ */
+static void fill_stosl(uint8_t* d, uint32_t val32, size_t n) {
+    rep_stosl(d, val32, n / 4);
+    rep_stosb(d + (n & ~3U), (uint8_t)val32, n & 3);
+}
+
+/**
+ * Fill with a byte: rep stosb (ERMS)
+ */
+static void fill_stosb(uint8_t* d, uint32_t val32, size_t n) {
+    rep_stosb(d, (uint8_t)val32, n);
+}
+
+/**
+ * Fill with a byte: byte head, 64-byte SSE2 blocks, byte tail
+ */
+static void fill_sse2(uint8_t* d, uint32_t val32, size_t n) {
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    rep_stosb(d, (uint8_t)val32, head);
+    d += head;
+    n -= head;
+    bool nt = n >= STRING_NT_FILL;
+    for (size_t left = n & ~63U; left; ) {
+        size_t chunk = (left < STRING_FPU_CHUNK) ? left : STRING_FPU_CHUNK;
+        uint32_t flags = fpu_begin();
+        sse2_fill(d, val32, chunk / 64, nt);
+        fpu_end(flags);
+        d += chunk;
+        left -= chunk;
+    }
+    rep_stosb(d, (uint8_t)val32, n & 63);
+}
+
+/**
+ * Fill with a byte: rep stosb, SSE2 non-temporal for large blocks (ERMS + SSE2)
+ */
+static void fill_stosb_nt(uint8_t* d, uint32_t val32, size_t n) {
+    if (n >= STRING_NT_FILL) {
+        fill_sse2(d, val32, n);
+    } else {
+        rep_stosb(d, (uint8_t)val32, n);
+    }
+}
+
+/**
+ * Fill n 32-bit words: rep stosl
+ */
+static void fill32_stosl(uint32_t* d, uint32_t val, size_t n) {
+    rep_stosl(d, val, n);
+}
+
+/**
+ * Fill n 32-bit words: word head up to 16-byte alignment, SSE2 blocks, word tail
+ * (the pattern is the same at every word, so the blocks stay in phase)
+ */
+static void fill32_sse2(uint32_t* d, uint32_t val, size_t n) {
+    size_t head = ((16 - ((uintptr_t)d & 15)) & 15) / 4;
+    if (head > n) {
+        head = n;
+    }
+    rep_stosl(d, val, head);
+    d += head;
+    n -= head;
+    bool nt = n * 4 >= STRING_NT_FILL;
+    for (size_t left = n & ~15U; left; ) {
+        size_t chunk = (left < STRING_FPU_CHUNK / 4) ? left : STRING_FPU_CHUNK / 4;
+        uint32_t flags = fpu_begin();
+        sse2_fill((uint8_t*)d, val, chunk / 16, nt);
+        fpu_end(flags);
+        d += chunk;
+        left -= chunk;
+    }
+    rep_stosl(d, val, n & 15);
+}
+
+/**
+ * Blend one ARGB pixel over another by its alpha byte, exactly as
+ * gfx_blend_colors(): opaque replaces, clear keeps, otherwise the blended
+ * color with a zero alpha byte
+ */
+static inline uint32_t blend_pixel(uint32_t src, uint32_t dst) {
+    uint32_t a = src >> 24;
+    if (a == 255) {
+        return src;
+    }
+    if (a == 0) {
+        return dst;
+    }
+    uint32_t r = (((src >> 16) & 0xFF) * a + ((dst >> 16) & 0xFF) * (255 - a)) / 255;
+    uint32_t g = (((src >> 8) & 0xFF) * a + ((dst >> 8) & 0xFF) * (255 - a)) / 255;
+    uint32_t b = ((src & 0xFF) * a + (dst & 0xFF) * (255 - a)) / 255;
+    return (r << 16) | (g << 8) | b;
+}
+
+/**
+ * Blend n pixels, one at a time
+ */
+static void blend_u32(uint32_t* d, const uint32_t* s, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        d[i] = blend_pixel(s[i], d[i]);
+    }
+}
+
+/**
+ * x / 255 for x <= 255 * 255, per 16-bit lane
+ */
+__attribute__((target("sse2")))
+static inline v8u16 sse2_div255(v8u16 x) {
+    return (x + 1 + (x >> 8)) >> 8;
+}
+
+/**
+ * Blend 4 * blocks pixels. Each 16-bit lane holds one channel: blue and red
+ * from the low bytes, green and alpha from the high bytes, so the products
+ * (at most 255 * 255) never overflow their lane
+ */
+__attribute__((target("sse2")))
+static void sse2_blend(uint32_t* d, const uint32_t* s, size_t blocks) {
+    const v4u32 low_bytes = { 0x00FF00FF, 0x00FF00FF, 0x00FF00FF, 0x00FF00FF };
+    const v4u32 color = { 0x00FFFFFF, 0x00FFFFFF, 0x00FFFFFF, 0x00FFFFFF };
+    for (; blocks; blocks--, d += 4, s += 4) {
+        v4u32 src = *(const v4u32_unaligned*)s;
+        v4u32 dst = *(const v4u32_unaligned*)d;
+        v4u32 a = src >> 24;
+        v8u16 fa = (v8u16)(a | (a << 16));
+        v8u16 ba = 255 - fa;
+        v8u16 br = sse2_div255((v8u16)(src & low_bytes) * fa + (v8u16)(dst & low_bytes) * ba);
+        v8u16 ga = sse2_div255((v8u16)((src >> 8) & low_bytes) * fa +
+                               (v8u16)((dst >> 8) & low_bytes) * ba);
+        v4u32 mixed = ((v4u32)br | ((v4u32)ga << 8)) & color;
+        v4u32 opaque = (v4u32)(a == 255);
+        v4u32 clear = (v4u32)(a == 0);
+        *(v4u32_unaligned*)d = (src & opaque) | (dst & clear) | (mixed & ~(opaque | clear));
+    }
+}
+
+/**
+ * Blend n pixels, four at a time, with a pixel-at-a-time tail
+ */
+static void blend_sse2(uint32_t* d, const uint32_t* s, size_t n) {
+    for (size_t left = n & ~3U; left; ) {
+        size_t chunk = (left < STRING_FPU_CHUNK / 4) ? left : STRING_FPU_CHUNK / 4;
+        uint32_t flags = fpu_begin();
+        sse2_blend(d, s, chunk / 4);
+        fpu_end(flags);
+        d += chunk;
+        s += chunk;
+        left -= chunk;
+    }
+    blend_u32(d, s, n & 3);
+}
+
+/**
+ * Move to a higher overlapping dest, highest bytes first, 4 bytes at a time
+ */
+static void move_down_u32(uint8_t* d, const uint8_t* s, size_t n) {
+    for (; n >= 4; n -= 4) {
+        *(unaligned_u32*)(d + n - 4) = *(const unaligned_u32*)(s + n - 4);
+    }
+    while (n--) {
+        d[n] = s[n];
+    }
+}
+
+/**
+ * Move to a higher overlapping dest, highest bytes first, 16 bytes at a time
+ */
+static void move_down_sse2(uint8_t* d, const uint8_t* s, size_t n) {
+    while (n >= 16) {
+        size_t stop = (n > STRING_FPU_CHUNK) ? n - STRING_FPU_CHUNK : 0;
+        uint32_t flags = fpu_begin();
+        for (; n >= 16 && n > stop; n -= 16) {
+            sse2_move16(d + n - 16, s + n - 16);
+        }
+        fpu_end(flags);
+    }
+    while (n--) {
+        d[n] = s[n];
+    }
+}
+
+/*
+ * Block routines for STRING_SMALL bytes and up, picked once by
+ * string_init(). Until then, the rep movs/stos versions every x86 runs
+ */
+static struct {
+    void (*copy)(uint8_t* d, const uint8_t* s, size_t n);
+    void (*fill)(uint8_t* d, uint32_t val32, size_t n);
+    void (*fill32)(uint32_t* d, uint32_t val, size_t n);
+    void (*move_up)(uint8_t* d, const uint8_t* s, size_t n);    /* Overlap, d < s */
+    void (*move_down)(uint8_t* d, const uint8_t* s, size_t n);  /* Overlap, d > s */
+    void (*blend)(uint32_t* d, const uint32_t* s, size_t n);
+} string_ops = { copy_movsl, fill_stosl, fill32_stosl, copy_movsl, move_down_u32, blend_u32 };
+
+/**
+ * Pick the copy, fill and blend routines for this CPU
+ */
+void string_init(void) {
+    bool erms = cpu_has(CPU_ERMS);
+    bool sse2 = cpu_has(CPU_SSE2);
+#ifndef TARKOS_HOSTED
+    /* SSE instructions fault until the OS enables them */
+    uint32_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    if (!(cr4 & CR4_OSFXSR)) {
+        sse2 = false;
+    }
+#endif
+    
+    if (sse2) {
+        string_ops.copy = erms ? copy_movsb_nt : copy_sse2;
+        string_ops.fill = erms ? fill_stosb_nt : fill_sse2;
+        string_ops.fill32 = fill32_sse2;
+        string_ops.move_down = move_down_sse2;
+        string_ops.blend = blend_sse2;
+    } else if (erms) {
+        string_ops.copy = copy_movsb;
+        string_ops.fill = fill_stosb;
+    }
+    
+    /* rep movs is defined to copy in address order, so it handles d < s overlap */
+    if (erms) {
+        string_ops.move_up = copy_movsb;
+    }
+}
 
 /**
  * Copy memory from source to destination
@@ -12,20 +427,17 @@ void* memcpy(void* dest, const void* src, size_t n) {
     uint8_t* d = (uint8_t*)dest;
     const uint8_t* s = (const uint8_t*)src;
     
-    /* Optimize for aligned copies */
-    if (((uintptr_t)d & 3) == 0 && ((uintptr_t)s & 3) == 0) {
-        while (n >= 4) {
-            *(uint32_t*)d = *(const uint32_t*)s;
-            d += 4;
-            s += 4;
-            n -= 4;
-        }
+    if (n >= STRING_SMALL) {
+        string_ops.copy(d, s, n);
+        return dest;
     }
     
+    for (; n >= 4; n -= 4, d += 4, s += 4) {
+        *(unaligned_u32*)d = *(const unaligned_u32*)s;
+    }
     while (n--) {
         *d++ = *s++;
     }
-    
     return dest;
 }
 
@@ -35,21 +447,19 @@ void* memcpy(void* dest, const void* src, size_t n) {
 void* memset(void* dest, int c, size_t n) {
     uint8_t* d = (uint8_t*)dest;
     uint8_t val = (uint8_t)c;
+    uint32_t val32 = val * 0x01010101U;
     
-    /* Optimize for aligned sets */
-    if (((uintptr_t)d & 3) == 0 && n >= 4) {
-        uint32_t val32 = val | (val << 8) | (val << 16) | (val << 24);
-        while (n >= 4) {
-            *(uint32_t*)d = val32;
-            d += 4;
-            n -= 4;
-        }
+    if (n >= STRING_SMALL) {
+        string_ops.fill(d, val32, n);
+        return dest;
     }
     
+    for (; n >= 4; n -= 4, d += 4) {
+        *(unaligned_u32*)d = val32;
+    }
     while (n--) {
         *d++ = val;
     }
-    
     return dest;
 }
 
@@ -66,12 +476,18 @@ void* memsetw(void* dest, uint16_t val, size_t n) {
 
 /**
  * Set memory to a 32-bit value
+ * dest must be 4-byte aligned, as for any uint32_t array
  */
 void* memsetl(void* dest, uint32_t val, size_t n) {
-    uint32_t* d = (uint32_t*)dest;
-    while (n--) {
-        *d++ = val;
-    }
+    string_ops.fill32((uint32_t*)dest, val, n);
+    return dest;
+}
+
+/**
+ * Alpha-blend 32-bit ARGB pixels over dest by each source alpha byte
+ */
+void* memblendl(uint32_t* dest, const uint32_t* src, size_t n) {
+    string_ops.blend(dest, src, n);
     return dest;
 }
 
@@ -95,25 +511,25 @@ int memcmp(const void* s1, const void* s2, size_t n) {
 
 /**
  * Move memory (handles overlapping regions)
+ * Forward copies are safe whenever dest is below src, since every block is
+ * read before the bytes after it are written; a higher overlapping dest is
+ * copied backwards
  */
 void* memmove(void* dest, const void* src, size_t n) {
     uint8_t* d = (uint8_t*)dest;
     const uint8_t* s = (const uint8_t*)src;
     
+    if (d == s || n == 0) {
+        return dest;
+    }
+    if (d + n <= s || d >= s + n) {
+        return memcpy(dest, src, n);  /* No overlap */
+    }
     if (d < s) {
-        /* Copy forward */
-        while (n--) {
-            *d++ = *s++;
-        }
-    } else if (d > s) {
-        /* Copy backward */
-        d += n;
-        s += n;
-        while (n--) {
-            *--d = *--s;
-        }
+        string_ops.move_up(d, s, n);
+    } else {
+        string_ops.move_down(d, s, n);
     }
-    
     return dest;
 }
 
@@ -0,0 +1,151 @@
+/**
+ * TarkOS - Memory Report Implementation
+ * Collects PMM, slab and paging statistics into a table for the console
+ * and key=value records for serial collectors
+ */
+
+#include <kernel/meminfo.h>
+#include <kernel/pmm.h>
+#include <kernel/slab.h>
+#include <kernel/paging.h>
+#include <kernel/serial.h>
+#include <lib/printf.h>
+#include <lib/string.h>
+
+/* Longest report line: a slab record with a long cache name */
+#define MEMINFO_LINE_SIZE   192
+
+/* Cache names are cut to fit the table column */
+#define MEMINFO_NAME_WIDTH  16
+
+static char line[MEMINFO_LINE_SIZE];
+
+/**
+ * Copy a name left-aligned into a fixed-width column
+ * @return Characters written (always width)
+ */
+static int pad_name(char* dst, const char* name, uint32_t width) {
+    uint32_t i = 0;
+    while (i < width - 1 && name[i]) {
+        dst[i] = name[i];
+        i++;
+    }
+    while (i < width) {
+        dst[i++] = ' ';
+    }
+    dst[i] = '\0';
+    return width;
+}
+
+/**
+ * Write the readable memory report
+ */
+void meminfo_print(meminfo_write_t write) {
+    /* Totals */
+    sprintf(line, "Memory: %u KB total, %u KB used, %u KB free\n",
+            (uint32_t)(pmm_get_total_memory() >> 10),
+            (uint32_t)(pmm_get_used_memory() >> 10),
+            (uint32_t)(pmm_get_free_memory() >> 10));
+    write(line);
+    sprintf(line, "        %u pages in per-CPU caches, %u pre-zeroed\n",
+            pmm_get_cached_pages(), pmm_get_zeroed_pages());
+    write(line);
+    
+    /* Zones */
+    write("Zone         Start KB      End KB     Free KB\n");
+    for (uint32_t zone = 0; zone < PMM_ZONES; zone++) {
+        pmm_zone_info_t info;
+        pmm_get_zone_info(zone, &info);
+        int len = pad_name(line, info.name, 8);
+        sprintf(line + len, " %11u %11u %11u\n", (uint32_t)(info.start >> 10),
+                (uint32_t)(info.end >> 10), info.free_pages * (PAGE_SIZE / 1024));
+        write(line);
+    }
+    
+    /* Fragmentation */
+    uint32_t run = pmm_get_largest_free_run();
+    sprintf(line, "Largest free run: %u pages (%u KB)\n", run, run * (PAGE_SIZE / 1024));
+    write(line);
+    
+    uint32_t blocks[PMM_MAX_ORDER + 1];
+    pmm_get_free_blocks(blocks);
+    char* p = line + sprintf(line, "Free blocks by order:");
+    for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++) {
+        p += sprintf(p, " %u:%u", order, blocks[order]);
+    }
+    sprintf(p, "\n");
+    write(line);
+    
+    /* Slab caches */
+    write("Cache            Size   Active    Total  Slabs       KB\n");
+    for (uint32_t i = 0; i < slab_cache_count(); i++) {
+        slab_stats_t stats;
+        slab_get_stats(i, &stats);
+        int len = pad_name(line, stats.name, MEMINFO_NAME_WIDTH);
+        sprintf(line + len, "%5u %8u %8u %6u %8u\n", stats.obj_size, stats.active_objs,
+                stats.total_objs, stats.slabs, stats.slabs * (PAGE_SIZE / 1024));
+        write(line);
+    }
+    
+    /* Paging */
+    uint32_t tables = paging_get_table_pages();
+    sprintf(line, "Page tables: %u pages (%u KB)\n", tables, tables * (PAGE_SIZE / 1024));
+    write(line);
+}
+
+/**
+ * Write the memory report as key=value records
+ */
+void meminfo_print_raw(meminfo_write_t write) {
+    sprintf(line, "meminfo total_kb=%u used_kb=%u free_kb=%u cached_pages=%u "
+            "zeroed_pages=%u largest_free_run=%u table_pages=%u\n",
+            (uint32_t)(pmm_get_total_memory() >> 10),
+            (uint32_t)(pmm_get_used_memory() >> 10),
+            (uint32_t)(pmm_get_free_memory() >> 10),
+            pmm_get_cached_pages(), pmm_get_zeroed_pages(),
+            pmm_get_largest_free_run(), paging_get_table_pages());
+    write(line);
+    
+    for (uint32_t zone = 0; zone < PMM_ZONES; zone++) {
+        pmm_zone_info_t info;
+        pmm_get_zone_info(zone, &info);
+        sprintf(line, "meminfo.zone name=%s start_kb=%u end_kb=%u free_pages=%u\n",
+                info.name, (uint32_t)(info.start >> 10), (uint32_t)(info.end >> 10),
+                info.free_pages);
+        write(line);
+    }
+    
+    uint32_t blocks[PMM_MAX_ORDER + 1];
+    pmm_get_free_blocks(blocks);
+    for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++) {
+        sprintf(line, "meminfo.order order=%u free_blocks=%u\n", order, blocks[order]);
+        write(line);
+    }
+    
+    for (uint32_t i = 0; i < slab_cache_count(); i++) {
+        slab_stats_t stats;
+        slab_get_stats(i, &stats);
+        
+        /* Names are free text: keep the record splittable on spaces */
+        char name[MEMINFO_NAME_WIDTH * 2];
+        uint32_t n = 0;
+        while (n < sizeof(name) - 1 && stats.name[n]) {
+            name[n] = (stats.name[n] == ' ' || stats.name[n] == '=') ? '_' : stats.name[n];
+            n++;
+        }
+        name[n] = '\0';
+        
+        sprintf(line, "meminfo.slab name=%s obj_size=%u slabs=%u active=%u cached=%u "
+                "total=%u allocs=%u frees=%u failures=%u\n",
+                name, stats.obj_size, stats.slabs, stats.active_objs, stats.cached_objs,
+                stats.total_objs, stats.allocs, stats.frees, stats.failures);
+        write(line);
+    }
+}
+
+/**
+ * Write the record form of the report to COM1
+ */
+void meminfo_report_serial(void) {
+    meminfo_print_raw(serial_write);
+}
@@ -1,24 +1,107 @@
 /**
  * TarkOS - Paging Implementation
  * x86 virtual memory management with identity mapping
+ * Uses 4MB pages (CR4.PSE) wherever a range is 4MB-aligned, so the
+ * kernel window, direct map and framebuffer take a few TLB entries.
+ * The framebuffer is mapped write-combining through the PAT, or through
+ * a variable MTRR on CPUs without one. Ranges from paging_reserve are
+ * populated on demand by the page fault handler.
+ * Once paging is on, page tables are reached through the recursive
+ * directory entry, so they may live anywhere in physical memory.
+ * Built with TARKOS_PAE, entries are 64-bit and frames above 4GB can be
+ * mapped through the paging_kmap slots
  */
 
 #include <kernel/paging.h>
+#include <kernel/cpu.h>
 #include <kernel/pmm.h>
+#include <kernel/msr.h>
+#include <kernel/isr.h>
 #include <lib/string.h>
 
+/* CR0 bits */
+#define CR0_WP              (1 << 16)   /* Read-only pages apply to ring 0 too */
+#define CR0_NW              (1 << 29)
+#define CR0_CD              (1 << 30)
+
+/* MTRR bits */
+#define MTRR_CAP_WC         (1 << 10)   /* WC memory type supported */
+#define MTRR_ENABLE         (1 << 11)   /* In MTRR_DEF_TYPE */
+#define MTRR_VALID          (1 << 11)   /* In MTRR_PHYSMASK */
+
+/*
+ * PAT entries, PA0 first: the power-on table with PA4 changed from WB to WC.
+ * PA4 is only reached with the PAT bit set (PAGE_WC), so PWT and PCD keep
+ * selecting WT and UC- as before
+ */
+#define PAT_VALUE           ((uint64_t)MEM_TYPE_WB << 0  | (uint64_t)MEM_TYPE_WT << 8  | \
+                             (uint64_t)MEM_TYPE_UC_MINUS << 16 | (uint64_t)MEM_TYPE_UC << 24 | \
+                             (uint64_t)MEM_TYPE_WC << 32 | (uint64_t)MEM_TYPE_WT << 40 | \
+                             (uint64_t)MEM_TYPE_UC_MINUS << 48 | (uint64_t)MEM_TYPE_UC << 56)
+
 /* Page directory - must be page-aligned */
 static page_directory_t kernel_page_directory __attribute__((aligned(PAGE_SIZE)));
 
-/* Page tables for identity mapping first 16MB (4 tables * 4MB each) */
-static page_table_t kernel_page_tables[4] __attribute__((aligned(PAGE_SIZE)));
+#ifdef TARKOS_PAE
+/* Page directory pointer table: CR3 points here, one entry per directory page */
+static uint64_t page_dir_pointers[PAGE_DIR_PAGES] __attribute__((aligned(32)));
+#endif
+
+/* Page tables for the kernel window without large pages */
+#define KERNEL_WINDOW_TABLES (KERNEL_WINDOW_SIZE / (PAGE_TABLE_ENTRIES * PAGE_SIZE))
+static page_table_t kernel_page_tables[KERNEL_WINDOW_TABLES] __attribute__((aligned(PAGE_SIZE)));
+
+/* Page table holding the scratch page */
+static page_table_t scratch_page_table __attribute__((aligned(PAGE_SIZE)));
 
 /* Current page directory */
 static page_directory_t* current_page_directory = NULL;
 
+/* Page tables taken from the PMM (new tables and split large pages) */
+static uint32_t allocated_tables = 0;
+
+/* Shared zero page, mapped read-only for reads of demand-zero pages */
+static uint8_t zero_page[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+/* Paging is on: page tables must be reached through the recursive window */
+static bool paging_active = false;
+
+/* 4MB pages available and enabled */
+static bool pse_enabled = false;
+
+/* PAT programmed with PA4 = WC, so PAGE_WC may be used */
+static bool pat_enabled = false;
+
+/* Global pages enabled (CR4.PGE) */
+static bool pge_enabled = false;
+
+/* paging_kmap slots in use, bit n for slot n */
+static uint32_t kmap_used = 0;
+
 /* External kernel symbols */
 extern uint32_t _kernel_end;
 
+#ifdef TARKOS_PAE
+/**
+ * Point the page directory pointers at the directory's pages and load
+ * them into CR3
+ */
+static inline void load_page_directory(page_directory_t* dir) {
+    for (uint32_t i = 0; i < PAGE_DIR_PAGES; i++) {
+        page_dir_pointers[i] = ((uint32_t)dir + i * PAGE_SIZE) | PAGE_PRESENT;
+    }
+    __asm__ volatile("mov %0, %%cr3" : : "r"((uint32_t)page_dir_pointers) : "memory");
+}
+
+/**
+ * Get current page directory from CR3 (the first directory pointer)
+ */
+static inline page_directory_t* get_page_directory(void) {
+    uint32_t cr3;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    return (page_directory_t*)(uint32_t)(((uint64_t*)cr3)[0] & PAGE_FRAME_MASK);
+}
+#else
 /**
  * Load page directory into CR3
  */
@@ -34,6 +117,7 @@ static inline page_directory_t* get_page_directory(void) {
     __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
     return (page_directory_t*)(cr3 & PAGE_FRAME_MASK);
 }
+#endif
 
 /**
  * Enable paging by setting bit 31 of CR0
@@ -41,7 +125,7 @@ static inline page_directory_t* get_page_directory(void) {
 void paging_enable(void) {
     uint32_t cr0;
     __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
-    cr0 |= 0x80000000;  /* Set PG bit */
+    cr0 |= 0x80000000 | CR0_WP;  /* Set PG bit; WP so kernel writes fault on the zero page */
     __asm__ volatile("mov %0, %%cr0" : : "r"(cr0));
 }
 
@@ -64,6 +148,7 @@ void paging_flush_tlb(uint32_t virt) {
 
 /**
  * Flush the entire TLB by reloading CR3
+ * Global pages stay cached
  */
 void paging_flush_tlb_all(void) {
     uint32_t cr3;
@@ -71,85 +156,544 @@ void paging_flush_tlb_all(void) {
     __asm__ volatile("mov %0, %%cr3" : : "r"(cr3));
 }
 
+/**
+ * Flush the entire TLB, global pages included, by toggling CR4.PGE
+ */
+void paging_flush_tlb_global(void) {
+    if (!pge_enabled) {
+        paging_flush_tlb_all();
+        return;
+    }
+    
+    uint32_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    __asm__ volatile("mov %0, %%cr4" : : "r"(cr4 & ~CR4_PGE) : "memory");
+    __asm__ volatile("mov %0, %%cr4" : : "r"(cr4) : "memory");
+}
+
+/**
+ * Set bits in CR4 (CR4_PSE, CR4_PGE)
+ */
+static void cr4_set(uint32_t bits) {
+    uint32_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= bits;
+    __asm__ volatile("mov %0, %%cr4" : : "r"(cr4));
+}
+
+/**
+ * Disable caching and write back all cache lines before changing memory
+ * types (Intel SDM 11.11.8). Interrupts must be disabled by the caller
+ * @return The old CR0, for cache_enable()
+ */
+static uint32_t cache_disable(void) {
+    uint32_t cr0;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    __asm__ volatile("mov %0, %%cr0" : : "r"((cr0 | CR0_CD) & ~CR0_NW));
+    __asm__ volatile("wbinvd" : : : "memory");
+    paging_flush_tlb_global();
+    return cr0;
+}
+
+/**
+ * Write back caches again and restore CR0 after cache_disable()
+ */
+static void cache_enable(uint32_t cr0) {
+    __asm__ volatile("wbinvd" : : : "memory");
+    paging_flush_tlb_global();
+    __asm__ volatile("mov %0, %%cr0" : : "r"(cr0));
+}
+
+/**
+ * Program the PAT so PA4 is write-combining
+ */
+static void pat_init(void) {
+    uint32_t cr0 = cache_disable();
+    wrmsr(MSR_PAT, PAT_VALUE);
+    cache_enable(cr0);
+    pat_enabled = true;
+}
+
+/**
+ * Make a physical range write-combining with a free variable MTRR
+ * A variable MTRR covers a power-of-two size aligned to that size, so the
+ * range is rounded up to one; an existing UC MTRR over it still wins
+ * @return false if WC is unsupported, the base is misaligned or no MTRR is free
+ */
+static bool mtrr_set_wc(uint32_t base, uint32_t size) {
+    uint64_t cap = rdmsr(MSR_MTRR_CAP);
+    if (!(cap & MTRR_CAP_WC)) {
+        return false;
+    }
+    
+    uint32_t span = PAGE_SIZE;
+    while (span < size && span != 0) {
+        span <<= 1;
+    }
+    if (span == 0 || (base & (span - 1)) != 0) {
+        return false;
+    }
+    
+    uint32_t count = cap & 0xFF;
+    uint32_t slot = 0;
+    while (slot < count && (rdmsr(MSR_MTRR_PHYSMASK(slot)) & MTRR_VALID)) {
+        slot++;
+    }
+    if (slot == count) {
+        return false;
+    }
+    
+    uint64_t addr_mask = (1ULL << cpu_get_info()->phys_bits) - 1;
+    uint64_t def_type = rdmsr(MSR_MTRR_DEF_TYPE);
+    uint32_t cr0 = cache_disable();
+    wrmsr(MSR_MTRR_DEF_TYPE, def_type & ~(uint64_t)MTRR_ENABLE);
+    wrmsr(MSR_MTRR_PHYSBASE(slot), base | MEM_TYPE_WC);
+    wrmsr(MSR_MTRR_PHYSMASK(slot), (~(uint64_t)(span - 1) & addr_mask) | MTRR_VALID);
+    wrmsr(MSR_MTRR_DEF_TYPE, def_type);
+    cache_enable(cr0);
+    return true;
+}
+
+/**
+ * Map a physical frame at the scratch page
+ * Before paging is on, the frame is simply returned
+ */
+static void* scratch_map(phys_addr_t phys) {
+    if (!paging_active) {
+        return (void*)(uint32_t)phys;  /* Tables come from below 4GB */
+    }
+    
+    scratch_page_table.entries[PAGE_TABLE_INDEX(PAGE_SCRATCH_VIRT)] =
+        (phys & PAGE_FRAME_MASK) | PAGE_PRESENT | PAGE_WRITE;
+    paging_flush_tlb(PAGE_SCRATCH_VIRT);
+    return (void*)PAGE_SCRATCH_VIRT;
+}
+
+/**
+ * Remove the scratch mapping
+ */
+static void scratch_unmap(void) {
+    if (paging_active) {
+        scratch_page_table.entries[PAGE_TABLE_INDEX(PAGE_SCRATCH_VIRT)] = 0;
+        paging_flush_tlb(PAGE_SCRATCH_VIRT);
+    }
+}
+
+/**
+ * Get the page table behind a present directory entry
+ */
+static page_table_t* page_table_at(uint32_t dir_index) {
+    if (!paging_active) {
+        return (page_table_t*)(uint32_t)(current_page_directory->entries[dir_index] & PAGE_FRAME_MASK);
+    }
+    return (page_table_t*)(PAGE_TABLES_VIRT + dir_index * PAGE_SIZE);
+}
+
+/**
+ * Point a directory entry at a new page table
+ * The table is filled through the scratch page before it is installed, so
+ * the range it covers is never mapped by a half-written table
+ * @param base Physical address mapped by the first entry, or 0 for an empty table
+ * @param flags Entry flags for base mappings (0 for an empty table)
+ * @return The new page table, or NULL when out of memory
+ */
+static page_table_t* install_page_table(uint32_t dir_index, phys_addr_t base, uint32_t flags) {
+    uint32_t table_phys = pmm_alloc_page();
+    if (table_phys == 0) {
+        return NULL;  /* Out of memory */
+    }
+    
+    page_table_t* table = scratch_map(table_phys);
+    if (flags == 0) {
+        memset(table, 0, sizeof(page_table_t));
+    } else {
+        for (int i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+            table->entries[i] = (base + i * PAGE_SIZE) | flags;
+        }
+    }
+    scratch_unmap();
+    allocated_tables++;
+    
+    current_page_directory->entries[dir_index] = table_phys | PAGE_PRESENT | PAGE_WRITE;
+    if (paging_active) {
+        /* The window slot may still cache whatever the old entry mapped */
+        paging_flush_tlb(PAGE_TABLES_VIRT + dir_index * PAGE_SIZE);
+    }
+    return page_table_at(dir_index);
+}
+
+/**
+ * Drop the page table behind a directory entry a large page has replaced
+ * Its 4KB mappings may be cached anywhere in the 4MB range, so the whole
+ * TLB is flushed before the table is freed. The window and scratch tables
+ * are static and are kept
+ */
+static void release_page_table(page_dir_entry_t entry) {
+    if (!(entry & PAGE_PRESENT) || (entry & PAGE_SIZE_4MB)) {
+        return;
+    }
+    if (paging_active) {
+        paging_flush_tlb_global();
+    }
+    
+    uint32_t table_phys = (uint32_t)(entry & PAGE_FRAME_MASK);
+    if ((table_phys >= (uint32_t)kernel_page_tables &&
+         table_phys < (uint32_t)(kernel_page_tables + KERNEL_WINDOW_TABLES)) ||
+        table_phys == (uint32_t)&scratch_page_table) {
+        return;
+    }
+    pmm_free_page(table_phys);
+    allocated_tables--;
+}
+
 /**
  * Get or create page table for a virtual address
+ * A 4MB mapping is split into a page table with the same 1024 mappings
+ * when create is set, so part of it can be changed
  */
 static page_table_t* get_page_table(uint32_t virt, bool create) {
     uint32_t dir_index = PAGE_DIR_INDEX(virt);
-    page_dir_entry_t* entry = &current_page_directory->entries[dir_index];
+    page_dir_entry_t entry = current_page_directory->entries[dir_index];
+    
+    if (dir_index >= PAGE_RECURSIVE_INDEX) {
+        return NULL;  /* The window onto the page tables themselves */
+    }
     
-    if (!(*entry & PAGE_PRESENT)) {
+    if ((entry & PAGE_PRESENT) && (entry & PAGE_SIZE_4MB)) {
         if (!create) {
             return NULL;
         }
-        
-        /* Allocate a new page table */
-        uint32_t table_phys = pmm_alloc_page();
-        if (table_phys == 0) {
-            return NULL;  /* Out of memory */
+        uint32_t flags = entry & PAGE_FLAGS_MASK & ~PAGE_SIZE_4MB;
+        if (entry & PAGE_LARGE_PAT) {
+            flags |= PAGE_PAT;  /* Bit 7 means PAT again in a page table */
         }
-        
-        /* Clear the new page table */
-        memset((void*)table_phys, 0, PAGE_SIZE);
-        
-        /* Set up page directory entry */
-        *entry = table_phys | PAGE_PRESENT | PAGE_WRITE;
+        return install_page_table(dir_index, entry & PAGE_LARGE_FRAME_MASK, flags);
+    }
+    
+    if (!(entry & PAGE_PRESENT)) {
+        if (!create) {
+            return NULL;
+        }
+        return install_page_table(dir_index, 0, 0);
     }
     
-    return (page_table_t*)(*entry & PAGE_FRAME_MASK);
+    return page_table_at(dir_index);
 }
 
+static void paging_init_tables(uint32_t global);
+static void page_fault_handler(registers_t* regs);
+
 /**
  * Initialize paging with identity mapping
  */
 void paging_init(void) {
     /* Clear page directory */
     memset(&kernel_page_directory, 0, sizeof(page_directory_t));
+    current_page_directory = &kernel_page_directory;
+    
+    /* Kernel mappings are global, so address space switches keep them */
+    uint32_t global = cpu_has(CPU_PGE) ? PAGE_GLOBAL : 0;
+    
+#ifdef TARKOS_PAE
+    if (!cpu_has(CPU_PAE)) {
+        return;  /* Built for PAE on a CPU without it: stay unpaged */
+    }
+    cr4_set(CR4_PAE);
+    pse_enabled = true;  /* PAE always has 2MB pages */
+#else
+    pse_enabled = cpu_has(CPU_PSE);
+#endif
+    if (pse_enabled) {
+        cr4_set(CR4_PSE);
+        
+        /* Map the kernel window at 0 and in the higher half with large pages */
+        for (uint32_t i = 0; i < KERNEL_WINDOW_SIZE / PAGE_LARGE_SIZE; i++) {
+            page_dir_entry_t entry =
+                (i * PAGE_LARGE_SIZE) | PAGE_PRESENT | PAGE_WRITE | PAGE_SIZE_4MB | global;
+            kernel_page_directory.entries[i] = entry;
+            kernel_page_directory.entries[PAGE_DIR_INDEX(KERNEL_VIRTUAL_BASE) + i] = entry;
+        }
+    } else {
+        paging_init_tables(global);
+    }
+    
+    /*
+     * Direct map: usable low memory past the kernel window, continuing the
+     * higher-half mapping, so every frame from the uint32_t PMM calls has a
+     * kernel address (pmm_to_virt). Holes and MMIO stay unmapped
+     */
+    phys_addr_t start, end;
+    for (uint32_t i = 0; pmm_get_usable_range(i, &start, &end); i++) {
+        if (start < KERNEL_WINDOW_SIZE) {
+            start = KERNEL_WINDOW_SIZE;
+        }
+        if (end > DIRECT_MAP_SIZE) {
+            end = DIRECT_MAP_SIZE;
+        }
+        if (start < end) {
+            paging_map_range(KERNEL_VIRTUAL_BASE + (uint32_t)start, (uint32_t)start,
+                             (uint32_t)(end - start), PAGE_PRESENT | PAGE_WRITE | global);
+        }
+    }
+    
+    /* Scratch page table, and the directory mapped onto itself */
+    memset(&scratch_page_table, 0, sizeof(page_table_t));
+    kernel_page_directory.entries[PAGE_DIR_INDEX(PAGE_SCRATCH_VIRT)] =
+        (uint32_t)&scratch_page_table | PAGE_PRESENT | PAGE_WRITE;
+    for (uint32_t i = 0; i < PAGE_DIR_PAGES; i++) {
+        kernel_page_directory.entries[PAGE_RECURSIVE_INDEX + i] =
+            ((uint32_t)&kernel_page_directory + i * PAGE_SIZE) | PAGE_PRESENT | PAGE_WRITE;
+    }
+    
+    if (cpu_has(CPU_PAT)) {
+        pat_init();
+    }
+    
+    register_interrupt_handler(EXC_PAGE_FAULT, page_fault_handler);
     
-    /* Set up identity mapping for first 16MB using pre-allocated tables */
-    for (int i = 0; i < 4; i++) {
+    /* Load page directory and enable paging */
+    load_page_directory(&kernel_page_directory);
+    paging_enable();
+    paging_active = true;
+    
+    if (global) {
+        cr4_set(CR4_PGE);
+        pge_enabled = true;
+    }
+}
+
+/**
+ * Map the kernel window at 0 and in the higher half with the
+ * pre-allocated 4KB page tables (both halves share the tables)
+ */
+static void paging_init_tables(uint32_t global) {
+    for (uint32_t i = 0; i < KERNEL_WINDOW_TABLES; i++) {
         /* Clear page table */
         memset(&kernel_page_tables[i], 0, sizeof(page_table_t));
         
         /* Fill page table with identity mappings */
-        for (int j = 0; j < PAGE_TABLE_ENTRIES; j++) {
+        for (uint32_t j = 0; j < PAGE_TABLE_ENTRIES; j++) {
             uint32_t phys_addr = (i * PAGE_TABLE_ENTRIES + j) * PAGE_SIZE;
-            kernel_page_tables[i].entries[j] = phys_addr | PAGE_PRESENT | PAGE_WRITE;
+            kernel_page_tables[i].entries[j] = phys_addr | PAGE_PRESENT | PAGE_WRITE | global;
         }
         
         /* Add page table to page directory */
-        kernel_page_directory.entries[i] = 
-            (uint32_t)&kernel_page_tables[i] | PAGE_PRESENT | PAGE_WRITE;
+        page_dir_entry_t entry = (uint32_t)&kernel_page_tables[i] | PAGE_PRESENT | PAGE_WRITE;
+        kernel_page_directory.entries[i] = entry;
+        kernel_page_directory.entries[PAGE_DIR_INDEX(KERNEL_VIRTUAL_BASE) + i] = entry;
     }
-    
-    /* Set current page directory */
-    current_page_directory = &kernel_page_directory;
-    
-    /* Load page directory and enable paging */
-    load_page_directory(&kernel_page_directory);
-    paging_enable();
 }
 
 /**
- * Map a virtual address to a physical address
+ * Set one 4KB mapping without flushing the TLB
+ * @return false if no page table could be created
  */
-void paging_map(uint32_t virt, uint32_t phys, uint32_t flags) {
+static bool map_page(uint32_t virt, uint32_t phys, uint32_t flags) {
     page_table_t* table = get_page_table(virt, true);
     if (table == NULL) {
-        return;  /* Failed to get/create page table */
+        return false;  /* Failed to get/create page table */
     }
     
     uint32_t table_index = PAGE_TABLE_INDEX(virt);
     table->entries[table_index] = (phys & PAGE_FRAME_MASK) | (flags & PAGE_FLAGS_MASK);
+    return true;
+}
+
+/**
+ * Map a virtual address to a physical address
+ */
+void paging_map(uint32_t virt, uint32_t phys, uint32_t flags) {
+    if (!pat_enabled) {
+        flags &= ~PAGE_WC;
+    }
+    
+    if (map_page(virt, phys, flags)) {
+        paging_flush_tlb(virt);
+    }
+}
+
+/**
+ * Map a range, using a 4MB page wherever virt and phys are both 4MB-aligned
+ * with at least 4MB left, and 4KB pages elsewhere. The TLB is flushed once
+ * at the end: per entry for small ranges, whole (global pages included) for large ones
+ */
+void paging_map_range(uint32_t virt, uint32_t phys, uint32_t size, uint32_t flags) {
+    uint32_t start = PAGE_ALIGN_DOWN(virt);
+    uint32_t end = PAGE_ALIGN_UP(virt + size);
+    uint32_t entries = 0;
+    
+    phys = PAGE_ALIGN_DOWN(phys);
+    if (!pat_enabled) {
+        flags &= ~PAGE_WC;
+    }
+    
+    /* In a large page entry bit 7 is the page size, and the PAT bit is bit 12 */
+    uint32_t large_flags = (flags & PAGE_FLAGS_MASK & ~PAGE_PAT) | PAGE_SIZE_4MB |
+                           ((flags & PAGE_PAT) ? PAGE_LARGE_PAT : 0);
+    
+    for (virt = start; virt < end; entries++) {
+        uint32_t step = PAGE_SIZE;
+        
+        if (pse_enabled && (virt & (PAGE_LARGE_SIZE - 1)) == 0 &&
+            (phys & (PAGE_LARGE_SIZE - 1)) == 0 && end - virt >= PAGE_LARGE_SIZE &&
+            PAGE_DIR_INDEX(virt) < PAGE_DIR_INDEX(PAGE_SCRATCH_VIRT)) {
+            page_dir_entry_t old = current_page_directory->entries[PAGE_DIR_INDEX(virt)];
+            current_page_directory->entries[PAGE_DIR_INDEX(virt)] =
+                phys | large_flags;
+            if (paging_active) {
+                paging_flush_tlb(PAGE_TABLES_VIRT + PAGE_DIR_INDEX(virt) * PAGE_SIZE);
+            }
+            release_page_table(old);  /* A 4KB table it replaces is no longer reachable */
+            step = PAGE_LARGE_SIZE;
+        } else if (!map_page(virt, phys, flags)) {
+            break;
+        }
+        
+        virt += step;
+        phys += step;
+        if (virt == 0) {
+            break;  /* Wrapped past 4GB */
+        }
+    }
+    
+    if (entries > PAGING_FLUSH_THRESHOLD) {
+        /* The range may replace global mappings, which a CR3 reload keeps */
+        paging_flush_tlb_global();
+        return;
+    }
+    
+    /* One invlpg per entry; a 4MB entry is flushed by its first address */
+    for (virt = start; entries > 0; entries--) {
+        paging_flush_tlb(virt);
+        page_dir_entry_t entry = current_page_directory->entries[PAGE_DIR_INDEX(virt)];
+        virt += (entry & PAGE_SIZE_4MB) ? PAGE_LARGE_SIZE : PAGE_SIZE;
+    }
+}
+
+/**
+ * Reserve a demand-zero range
+ * Entries stay not-present with PAGE_DEMAND set and the final flags kept
+ * in the low bits; PAGE_WRITE moves to PAGE_DEMAND_WRITE until a write
+ */
+bool paging_reserve(uint32_t virt, uint32_t size, uint32_t flags) {
+    uint32_t end = PAGE_ALIGN_UP(virt + size);
+    uint32_t entry = (flags & PAGE_FLAGS_MASK & ~(PAGE_PRESENT | PAGE_WRITE)) | PAGE_DEMAND;
+    
+    if (!pat_enabled) {
+        entry &= ~PAGE_WC;
+    }
+    if (flags & PAGE_WRITE) {
+        entry |= PAGE_DEMAND_WRITE;
+    }
+    
+    for (virt = PAGE_ALIGN_DOWN(virt); virt < end; virt += PAGE_SIZE) {
+        page_table_t* table = get_page_table(virt, true);
+        if (table == NULL) {
+            return false;
+        }
+        
+        /* Not present before, so there is nothing to flush */
+        table->entries[PAGE_TABLE_INDEX(virt)] = entry;
+    }
+    
+    return true;
+}
+
+/**
+ * Unmap a demand-zero range and free its populated frames
+ */
+void paging_release(uint32_t virt, uint32_t size) {
+    uint32_t end = PAGE_ALIGN_UP(virt + size);
+    
+    for (virt = PAGE_ALIGN_DOWN(virt); virt < end; virt += PAGE_SIZE) {
+        page_table_t* table = get_page_table(virt, false);
+        if (table == NULL) {
+            continue;
+        }
+        
+        page_table_entry_t* entry = &table->entries[PAGE_TABLE_INDEX(virt)];
+        if (!(*entry & PAGE_DEMAND)) {
+            continue;
+        }
+        
+        phys_addr_t frame = *entry & PAGE_FRAME_MASK;
+        bool present = (*entry & PAGE_PRESENT) != 0;
+        *entry = 0;
+        
+        if (present) {
+            paging_flush_tlb(virt);
+            if (frame != (uint32_t)zero_page) {
+                pmm_free_page64(frame);
+            }
+        }
+    }
+}
+
+/**
+ * Populate a demand-zero page: reads share the zero page, the first
+ * write replaces it with a zeroed frame
+ */
+bool paging_handle_fault(uint32_t virt, uint32_t error) {
+    page_table_t* table = get_page_table(virt, false);
+    if (table == NULL) {
+        return false;
+    }
+    
+    page_table_entry_t* entry = &table->entries[PAGE_TABLE_INDEX(virt)];
+    if (!(*entry & PAGE_DEMAND)) {
+        return false;
+    }
+    if ((error & PF_USER) && !(*entry & PAGE_USER)) {
+        return false;
+    }
+    
+    uint32_t flags = *entry & PAGE_FLAGS_MASK;
     
+    if (!(error & PF_WRITE)) {
+        if (*entry & PAGE_PRESENT) {
+            return false;
+        }
+        *entry = (uint32_t)zero_page | flags | PAGE_PRESENT;
+        return true;
+    }
+    
+    if (!(flags & PAGE_DEMAND_WRITE)) {
+        return false;
+    }
+    if (flags & PAGE_WRITE) {
+        paging_flush_tlb(virt);  /* Already populated; stale TLB entry */
+        return true;
+    }
+    
+    uint32_t frame = pmm_alloc_zeroed_page();
+    if (frame == 0) {
+        return false;
+    }
+    
+    *entry = frame | flags | PAGE_PRESENT | PAGE_WRITE;
     paging_flush_tlb(virt);
+    return true;
+}
+
+/**
+ * Page fault handler (vector 14)
+ */
+static void page_fault_handler(registers_t* regs) {
+    uint32_t cr2;
+    __asm__ volatile("mov %%cr2, %0" : "=r"(cr2));
+    
+    if (!paging_handle_fault(cr2, regs->err_code)) {
+        isr_panic(regs);
+    }
 }
 
 /**
  * Unmap a virtual address
  */
 void paging_unmap(uint32_t virt) {
-    page_table_t* table = get_page_table(virt, false);
+    /* Only a 4MB mapping is split here; a missing table is left missing */
+    page_dir_entry_t entry = current_page_directory->entries[PAGE_DIR_INDEX(virt)];
+    page_table_t* table = get_page_table(virt, (entry & PAGE_SIZE_4MB) != 0);
     if (table == NULL) {
         return;  /* Page table doesn't exist */
     }
@@ -163,7 +707,12 @@ void paging_unmap(uint32_t virt) {
 /**
  * Get physical address from virtual address
  */
-uint32_t paging_get_physical(uint32_t virt) {
+phys_addr_t paging_get_physical(uint32_t virt) {
+    page_dir_entry_t entry_4mb = current_page_directory->entries[PAGE_DIR_INDEX(virt)];
+    if ((entry_4mb & PAGE_PRESENT) && (entry_4mb & PAGE_SIZE_4MB)) {
+        return (entry_4mb & PAGE_LARGE_FRAME_MASK) | (virt & (PAGE_LARGE_SIZE - 1));
+    }
+    
     page_table_t* table = get_page_table(virt, false);
     if (table == NULL) {
         return 0;
@@ -180,14 +729,70 @@ uint32_t paging_get_physical(uint32_t virt) {
 }
 
 /**
- * Identity map a range of addresses
+ * Map a physical page at a free temporary kernel slot
+ * The slots live in the scratch page table, which is always present
  */
-void paging_identity_map(uint32_t start, uint32_t size, uint32_t flags) {
-    uint32_t addr = PAGE_ALIGN_DOWN(start);
-    uint32_t end = PAGE_ALIGN_UP(start + size);
+void* paging_kmap(phys_addr_t phys) {
+#ifndef TARKOS_PAE
+    if (phys >> 32) {
+        return NULL;  /* Out of reach without PAE */
+    }
+#endif
+    if (kmap_used == (1U << PAGING_KMAP_SLOTS) - 1) {
+        return NULL;
+    }
     
-    while (addr < end) {
-        paging_map(addr, addr, flags);
-        addr += PAGE_SIZE;
+    uint32_t slot = __builtin_ctz(~kmap_used);
+    uint32_t virt = PAGE_KMAP_VIRT + slot * PAGE_SIZE;
+    kmap_used |= 1U << slot;
+    
+    scratch_page_table.entries[PAGE_TABLE_INDEX(virt)] =
+        (phys & PAGE_FRAME_MASK) | PAGE_PRESENT | PAGE_WRITE;
+    paging_flush_tlb(virt);
+    return (void*)(virt + PAGE_OFFSET(phys));
+}
+
+/**
+ * Release a temporary kernel mapping
+ */
+void paging_kunmap(void* addr) {
+    uint32_t virt = PAGE_ALIGN_DOWN((uint32_t)addr);
+    if (virt < PAGE_KMAP_VIRT || virt >= PAGE_SCRATCH_VIRT) {
+        return;
     }
+    
+    scratch_page_table.entries[PAGE_TABLE_INDEX(virt)] = 0;
+    paging_flush_tlb(virt);
+    kmap_used &= ~(1U << ((virt - PAGE_KMAP_VIRT) / PAGE_SIZE));
+}
+
+/**
+ * Map a linear framebuffer write-combining at PAGE_FB_VIRT
+ */
+void* paging_map_framebuffer(uint32_t phys, uint32_t size) {
+    if (size > PAGE_FB_END - PAGE_FB_VIRT - PAGE_OFFSET(phys)) {
+        return NULL;
+    }
+    
+    if (!pat_enabled && cpu_has(CPU_MTRR)) {
+        mtrr_set_wc(phys, size);
+    }
+    paging_map_range(PAGE_FB_VIRT, phys, size + PAGE_OFFSET(phys),
+                     PAGE_PRESENT | PAGE_WRITE | PAGE_WC | (pge_enabled ? PAGE_GLOBAL : 0));
+    return (void*)(PAGE_FB_VIRT + PAGE_OFFSET(phys));
+}
+
+/**
+ * Identity map a range of addresses
+ */
+void paging_identity_map(uint32_t start, uint32_t size, uint32_t flags) {
+    paging_map_range(start, start, size, flags);
+}
+
+/**
+ * Get the memory held by paging structures
+ */
+uint32_t paging_get_table_pages(void) {
+    /* Directory, scratch table and the window tables are in bss either way */
+    return PAGE_DIR_PAGES + 1 + KERNEL_WINDOW_TABLES + allocated_tables;
 }
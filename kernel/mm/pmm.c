@@ -1,35 +1,228 @@
 /**
  * TarkOS - Physical Memory Manager Implementation
- * Bitmap-based physical page allocator
+ * Bitmap-based physical page allocator with a two-level summary of full
+ * bitmap words, so finding a free page costs a few bit scans, not a walk.
+ * A buddy allocator (orders 0..PMM_MAX_ORDER) tracks the same free pages
+ * as aligned power-of-two blocks and serves contiguous allocations.
+ * Single pages go through a per-CPU magazine that is refilled from and
+ * drained to the shared maps in batches. The idle loop keeps a per-CPU
+ * pool of pre-zeroed pages for pmm_alloc_zeroed_page().
+ * Memory above 768MB is tracked in the same maps; the 32-bit calls stay
+ * below LOW_MEMORY_PAGES (the direct map) and pmm_alloc_page64() prefers
+ * the pages above.
+ * Zones are page ranges of the same maps: searches start above the DMA
+ * zone so ordinary allocations leave ISA DMA memory alone.
  */
 
 #include <kernel/pmm.h>
+#include <kernel/percpu.h>
 #include <lib/string.h>
 
 /* Bitmap to track page usage (1 bit per 4KB page) */
 static uint32_t pmm_bitmap[BITMAP_SIZE];
 
+/* Summary levels: bit n is set when word n of the level below is full */
+#define SUMMARY_L1_SIZE     (BITMAP_SIZE / 32)
+#define SUMMARY_L2_SIZE     (SUMMARY_L1_SIZE / 32)
+static uint32_t pmm_summary_l1[SUMMARY_L1_SIZE];
+static uint32_t pmm_summary_l2[SUMMARY_L2_SIZE];
+
+/* Next-fit hints: low single-page searches start here, 64-bit ones at the high hint */
+static uint32_t next_fit_hint = 0;
+static uint32_t high_fit_hint = 0;
+
+/*
+ * Buddy free maps: bit b of order k set means pages [b << k, (b + 1) << k)
+ * form one free block. Invariant: a page is clear in pmm_bitmap exactly
+ * when it lies in one free buddy block. Each order has a summary of its
+ * non-zero map words and a hint below which that summary is empty.
+ */
+#define BUDDY_ORDERS        (PMM_MAX_ORDER + 1)
+#define BUDDY_MAP_WORDS     (BITMAP_SIZE * 2)
+#define BUDDY_SUMMARY_WORDS (BITMAP_SIZE / 16 + BUDDY_ORDERS)
+static uint32_t buddy_map_store[BUDDY_MAP_WORDS];
+static uint32_t buddy_summary_store[BUDDY_SUMMARY_WORDS];
+static uint32_t* buddy_map[BUDDY_ORDERS];
+static uint32_t* buddy_summary[BUDDY_ORDERS];
+static uint32_t buddy_summary_words[BUDDY_ORDERS];
+static uint32_t buddy_free_blocks[BUDDY_ORDERS];
+static uint32_t buddy_hint[BUDDY_ORDERS];
+
+/*
+ * Per-CPU page magazines: pages here are marked used in the bitmap but
+ * count as free. Only the owning CPU touches its magazine.
+ */
+typedef struct pmm_magazine {
+    uint32_t count;
+    uint32_t pages[PMM_MAG_SIZE];
+} CACHE_ALIGNED pmm_magazine_t;
+
+static pmm_magazine_t pmm_magazines[MAX_CPUS];
+
+/* Per-CPU pools of zeroed pages, filled by pmm_zero_idle() */
+typedef struct pmm_zero_pool {
+    uint32_t count;
+    uint32_t pages[PMM_ZERO_POOL_SIZE];
+} CACHE_ALIGNED pmm_zero_pool_t;
+
+static pmm_zero_pool_t pmm_zero_pools[MAX_CPUS];
+
+/*
+ * Pages parked in a magazine or zero pool, one bit each. They are free,
+ * so a second pmm_free_page() or region free of one is ignored instead of
+ * letting the page be handed out twice. Only low-memory pages are parked.
+ */
+#define PARKED_MAP_WORDS    (LOW_MEMORY_PAGES / 32)
+static uint32_t pmm_parked_map[PARKED_MAP_WORDS];
+
 /* Memory statistics */
-static uint32_t total_memory = 0;
+static uint64_t total_memory = 0;
 static uint32_t used_pages = 0;
 static uint32_t total_pages = 0;
 
+/* Pages with a 32-bit address: min(total_pages, LOW_MEMORY_PAGES) */
+static uint32_t low_pages = 0;
+
+/* DMA zone pages: min(total_pages, DMA_MEMORY_PAGES) */
+static uint32_t dma_pages = 0;
+
+static const char* const zone_names[PMM_ZONES] = { "DMA", "Normal", "High" };
+
+/* Usable memory map ranges, as page numbers [start, end) */
+static uint32_t usable_start[PMM_MAX_RANGES];
+static uint32_t usable_end[PMM_MAX_RANGES];
+static uint32_t usable_ranges = 0;
+
+/*
+ * Pages the maps are sized for on this machine, a multiple of one level-2
+ * summary bit; pmm_init only clears the maps up to here
+ */
+#define LIMIT_GRANULE       (32 * 32 * 32)
+static uint32_t limit_pages = 0;
+
 /* External symbols from linker script */
 extern uint32_t _kernel_start;
 extern uint32_t _kernel_end;
 
+/**
+ * Propagate the state of bitmap word w0 up through the summary levels
+ * (range operations; single-page paths update the summaries inline)
+ */
+static inline void summary_update(uint32_t w0) {
+    uint32_t w1 = w0 / 32;
+    if (pmm_bitmap[w0] == 0xFFFFFFFF) {
+        pmm_summary_l1[w1] |= (1U << (w0 % 32));
+        if (pmm_summary_l1[w1] == 0xFFFFFFFF) {
+            pmm_summary_l2[w1 / 32] |= (1U << (w1 % 32));
+        }
+    } else {
+        pmm_summary_l1[w1] &= ~(1U << (w0 % 32));
+        pmm_summary_l2[w1 / 32] &= ~(1U << (w1 % 32));
+    }
+}
+
 /**
  * Set a bit in the bitmap (mark page as used)
+ * Propagates "word is full" up through the summary levels
  */
 static inline void bitmap_set(uint32_t page) {
-    pmm_bitmap[page / 32] |= (1 << (page % 32));
+    uint32_t w0 = page / 32;
+    pmm_bitmap[w0] |= (1U << (page % 32));
+    if (pmm_bitmap[w0] == 0xFFFFFFFF) {
+        uint32_t w1 = w0 / 32;
+        pmm_summary_l1[w1] |= (1U << (w0 % 32));
+        if (pmm_summary_l1[w1] == 0xFFFFFFFF) {
+            pmm_summary_l2[w1 / 32] |= (1U << (w1 % 32));
+        }
+    }
 }
 
 /**
  * Clear a bit in the bitmap (mark page as free)
  */
 static inline void bitmap_clear(uint32_t page) {
-    pmm_bitmap[page / 32] &= ~(1 << (page % 32));
+    uint32_t w0 = page / 32;
+    uint32_t w1 = w0 / 32;
+    pmm_bitmap[w0] &= ~(1U << (page % 32));
+    pmm_summary_l1[w1] &= ~(1U << (w0 % 32));
+    pmm_summary_l2[w1 / 32] &= ~(1U << (w1 % 32));
+}
+
+/**
+ * Bits of the word holding page first that fall inside [first, end)
+ */
+static inline uint32_t range_mask(uint32_t first, uint32_t end) {
+    uint32_t hi = end - (first & ~31U);
+    uint32_t mask = 0xFFFFFFFF << (first % 32);
+    return (hi >= 32) ? mask : (mask & ((1U << hi) - 1));
+}
+
+/**
+ * Set or clear pages [first, end) a bitmap word at a time
+ */
+static void bitmap_set_range(uint32_t first, uint32_t end) {
+    while (first < end) {
+        uint32_t w0 = first / 32;
+        pmm_bitmap[w0] |= range_mask(first, end);
+        summary_update(w0);
+        first = (w0 + 1) * 32;
+    }
+}
+
+static void bitmap_clear_range(uint32_t first, uint32_t end) {
+    while (first < end) {
+        uint32_t w0 = first / 32;
+        pmm_bitmap[w0] &= ~range_mask(first, end);
+        summary_update(w0);
+        first = (w0 + 1) * 32;
+    }
+}
+
+/**
+ * First page in [page, end) that is used (set) or free (!set), or end
+ */
+static uint32_t bitmap_scan(uint32_t page, uint32_t end, bool set) {
+    while (page < end) {
+        uint32_t bits = set ? pmm_bitmap[page / 32] : ~pmm_bitmap[page / 32];
+        bits &= 0xFFFFFFFF << (page % 32);
+        if (bits != 0) {
+            page = (page & ~31U) + __builtin_ctz(bits);
+            return (page < end) ? page : end;
+        }
+        page = (page & ~31U) + 32;
+    }
+    return end;
+}
+
+/**
+ * Find the first parked page in [page, end)
+ * @return Page number, or end if none
+ */
+static uint32_t parked_scan(uint32_t page, uint32_t end) {
+    uint32_t limit = (end < LOW_MEMORY_PAGES) ? end : LOW_MEMORY_PAGES;
+    while (page < limit) {
+        uint32_t bits = pmm_parked_map[page / 32] & (0xFFFFFFFF << (page % 32));
+        if (bits != 0) {
+            page = (page & ~31U) + __builtin_ctz(bits);
+            return (page < end) ? page : end;
+        }
+        page = (page & ~31U) + 32;
+    }
+    return end;
+}
+
+/**
+ * Count used pages below end with popcount
+ */
+static uint32_t bitmap_count_used(uint32_t end) {
+    uint32_t count = 0;
+    for (uint32_t w0 = 0; w0 < end / 32; w0++) {
+        count += __builtin_popcount(pmm_bitmap[w0]);
+    }
+    if (end % 32) {
+        count += __builtin_popcount(pmm_bitmap[end / 32] & range_mask(end & ~31U, end));
+    }
+    return count;
 }
 
 /**
@@ -40,31 +233,280 @@ static inline bool bitmap_test(uint32_t page) {
 }
 
 /**
- * Find first free page in bitmap
+ * Mask of the bits strictly above bit n
+ */
+static inline uint32_t bits_above(uint32_t n) {
+    return (n >= 31) ? 0 : (0xFFFFFFFF << (n + 1));
+}
+
+/**
+ * Descend from a non-full level-1 word to its first free page
+ */
+static inline uint32_t summary_first_free(uint32_t w1) {
+    uint32_t w0 = w1 * 32 + __builtin_ctz(~pmm_summary_l1[w1]);
+    return w0 * 32 + __builtin_ctz(~pmm_bitmap[w0]);
+}
+
+/**
+ * Find the first free page at or after start
+ * Checks the rest of start's bitmap word, then its level-1 word, then
+ * its level-2 word, and only then scans level 2 (8 words for 1GB)
+ */
+static uint32_t bitmap_find_free_from(uint32_t start) {
+    if (start >= total_pages) {
+        return (uint32_t)-1;
+    }
+    
+    uint32_t w0 = start / 32;
+    uint32_t w1 = w0 / 32;
+    uint32_t w2 = w1 / 32;
+    uint32_t page = (uint32_t)-1;
+    uint32_t bits;
+    
+    if ((bits = ~pmm_bitmap[w0] & (0xFFFFFFFF << (start % 32))) != 0) {
+        page = w0 * 32 + __builtin_ctz(bits);
+    } else if ((bits = ~pmm_summary_l1[w1] & bits_above(w0 % 32)) != 0) {
+        w0 = w1 * 32 + __builtin_ctz(bits);
+        page = w0 * 32 + __builtin_ctz(~pmm_bitmap[w0]);
+    } else if ((bits = ~pmm_summary_l2[w2] & bits_above(w1 % 32)) != 0) {
+        page = summary_first_free(w2 * 32 + __builtin_ctz(bits));
+    } else {
+        uint32_t l2_words = (total_pages + 32 * 32 * 32 - 1) / (32 * 32 * 32);
+        for (w2 = w2 + 1; w2 < l2_words; w2++) {
+            if (pmm_summary_l2[w2] != 0xFFFFFFFF) {
+                page = summary_first_free(w2 * 32 + __builtin_ctz(~pmm_summary_l2[w2]));
+                break;
+            }
+        }
+    }
+    
+    return (page < total_pages) ? page : (uint32_t)-1;
+}
+
+/**
+ * Find a free low-memory page: next-fit from the last allocation through
+ * the normal zone, then the DMA zone
  */
 static uint32_t bitmap_find_free(void) {
-    for (uint32_t i = 0; i < total_pages / 32; i++) {
-        if (pmm_bitmap[i] != 0xFFFFFFFF) {
-            /* Found a block with at least one free page */
-            for (uint32_t j = 0; j < 32; j++) {
-                uint32_t page = i * 32 + j;
-                if (page < total_pages && !bitmap_test(page)) {
-                    return page;
-                }
+    uint32_t page = bitmap_find_free_from(next_fit_hint);
+    if (page >= low_pages && next_fit_hint > dma_pages) {
+        page = bitmap_find_free_from(dma_pages);
+    }
+    if (page >= low_pages) {
+        page = bitmap_find_free_from(0);
+    }
+    return (page < low_pages) ? page : (uint32_t)-1;  /* (uint32_t)-1 if no free pages */
+}
+
+/**
+ * Carve the free maps for every order out of the static stores, clearing
+ * the parts that cover the first clear_words bitmap words
+ */
+static void buddy_init(uint32_t clear_words) {
+    uint32_t map_off = 0;
+    uint32_t sum_off = 0;
+    
+    for (uint32_t k = 0; k < BUDDY_ORDERS; k++) {
+        uint32_t words = BITMAP_SIZE >> k;
+        buddy_map[k] = &buddy_map_store[map_off];
+        buddy_summary[k] = &buddy_summary_store[sum_off];
+        buddy_summary_words[k] = (words + 31) / 32;
+        buddy_free_blocks[k] = 0;
+        buddy_hint[k] = 0;
+        memset(buddy_map[k], 0, (clear_words >> k) * sizeof(uint32_t));
+        memset(buddy_summary[k], 0, ((clear_words >> k) + 31) / 32 * sizeof(uint32_t));
+        map_off += words;
+        sum_off += buddy_summary_words[k];
+    }
+}
+
+static inline bool buddy_test(uint32_t order, uint32_t block) {
+    return (buddy_map[order][block / 32] & (1U << (block % 32))) != 0;
+}
+
+static inline void buddy_mark_free(uint32_t order, uint32_t block) {
+    uint32_t w = block / 32;
+    buddy_map[order][w] |= (1U << (block % 32));
+    buddy_summary[order][w / 32] |= (1U << (w % 32));
+    buddy_free_blocks[order]++;
+    if (w / 32 < buddy_hint[order]) {
+        buddy_hint[order] = w / 32;
+    }
+}
+
+static inline void buddy_mark_taken(uint32_t order, uint32_t block) {
+    uint32_t w = block / 32;
+    buddy_map[order][w] &= ~(1U << (block % 32));
+    if (buddy_map[order][w] == 0) {
+        buddy_summary[order][w / 32] &= ~(1U << (w % 32));
+    }
+    buddy_free_blocks[order]--;
+}
+
+/**
+ * Lowest free block of an order (the order must have one)
+ */
+static uint32_t buddy_find(uint32_t order) {
+    uint32_t* summary = buddy_summary[order];
+    uint32_t s = buddy_hint[order];
+    
+    while (summary[s] == 0) {
+        s++;
+    }
+    buddy_hint[order] = s;
+    
+    uint32_t w = s * 32 + __builtin_ctz(summary[s]);
+    return w * 32 + __builtin_ctz(buddy_map[order][w]);
+}
+
+/**
+ * Lowest free block of an order at or after block first
+ * @return The block, or (uint32_t)-1 if there is none
+ */
+static uint32_t buddy_find_from(uint32_t order, uint32_t first) {
+    uint32_t* map = buddy_map[order];
+    uint32_t* summary = buddy_summary[order];
+    uint32_t words = ((limit_pages >> order) + 31) / 32;
+    uint32_t w = first / 32;
+    if (w / 32 < buddy_hint[order]) {
+        return buddy_find(order);  /* Nothing free below the hint: the lowest block qualifies */
+    }
+    if (w >= words) {
+        return (uint32_t)-1;
+    }
+    
+    uint32_t bits = map[w] & (0xFFFFFFFF << (first % 32));
+    if (bits != 0) {
+        return w * 32 + __builtin_ctz(bits);
+    }
+    
+    uint32_t s = w / 32;
+    uint32_t summary_words = (words + 31) / 32;
+    bits = summary[s] & bits_above(w % 32);
+    while (bits == 0) {
+        if (++s >= summary_words) {
+            return (uint32_t)-1;
+        }
+        bits = summary[s];
+    }
+    
+    w = s * 32 + __builtin_ctz(bits);
+    return w * 32 + __builtin_ctz(map[w]);
+}
+
+/**
+ * Return a block to the free maps, merging with its buddy while it is free
+ */
+static void buddy_insert(uint32_t page, uint32_t order) {
+    uint32_t block = page >> order;
+    
+    while (order < PMM_MAX_ORDER && buddy_test(order, block ^ 1)) {
+        buddy_mark_taken(order, block ^ 1);
+        block >>= 1;
+        order++;
+    }
+    buddy_mark_free(order, block);
+}
+
+/**
+ * Free pages [page, end) as the largest aligned blocks that fit
+ */
+static void buddy_insert_range(uint32_t page, uint32_t end) {
+    while (page < end) {
+        uint32_t order = 0;
+        while (order < PMM_MAX_ORDER &&
+               (page & ((2U << order) - 1)) == 0 &&
+               page + (2U << order) <= end) {
+            order++;
+        }
+        buddy_insert(page, order);
+        page += 1U << order;
+    }
+}
+
+/**
+ * Take one page out of the free block containing it, giving the
+ * remaining halves back as smaller blocks
+ */
+static void buddy_remove_page(uint32_t page) {
+    for (uint32_t k = 0; k < BUDDY_ORDERS; k++) {
+        if (buddy_test(k, page >> k)) {
+            buddy_mark_taken(k, page >> k);
+            while (k > 0) {
+                k--;
+                buddy_mark_free(k, (page >> k) ^ 1);
             }
+            return;
+        }
+    }
+}
+
+/**
+ * Take free pages [page, end) out of the free maps a block at a time,
+ * giving back the parts of each block that fall outside the range
+ */
+static void buddy_remove_range(uint32_t page, uint32_t end) {
+    while (page < end) {
+        uint32_t k = 0;
+        while (k < BUDDY_ORDERS && !buddy_test(k, page >> k)) {
+            k++;
+        }
+        if (k == BUDDY_ORDERS) {
+            page++;  /* Not free; nothing to take */
+            continue;
+        }
+        
+        uint32_t first = (page >> k) << k;
+        uint32_t last = first + (1U << k);
+        buddy_mark_taken(k, page >> k);
+        buddy_insert_range(first, page);
+        if (last > end) {
+            buddy_insert_range(end, last);
+            last = end;
         }
+        page = last;
+    }
+}
+
+/**
+ * Allocate a 2^order page block inside pages [min, limit), splitting a
+ * larger one if needed (the lowest block at or after min of each order is
+ * the only candidate)
+ * @return First page of the block, or (uint32_t)-1
+ */
+static uint32_t buddy_alloc(uint32_t order, uint32_t min, uint32_t limit) {
+    uint32_t k = order;
+    uint32_t block = 0;
+    while (k < BUDDY_ORDERS) {
+        if (buddy_free_blocks[k] != 0) {
+            block = (min == 0) ? buddy_find(k) : buddy_find_from(k, (min + (1U << k) - 1) >> k);
+            if (block != (uint32_t)-1 && ((block + 1) << k) <= limit) {
+                break;
+            }
+        }
+        k++;
+    }
+    if (k == BUDDY_ORDERS) {
+        return (uint32_t)-1;
+    }
+    
+    buddy_mark_taken(k, block);
+    while (k > order) {
+        k--;
+        block <<= 1;
+        buddy_mark_free(k, block | 1);
     }
-    return (uint32_t)-1;  /* No free pages */
+    return block << order;
 }
 
 /**
- * Find contiguous free pages
+ * Find contiguous free pages in [min, limit) (fallback for runs above the largest order)
  */
-static uint32_t bitmap_find_free_contiguous(uint32_t count) {
+static uint32_t bitmap_find_free_contiguous(uint32_t count, uint32_t min, uint32_t limit) {
     uint32_t start = 0;
     uint32_t found = 0;
     
-    for (uint32_t i = 0; i < total_pages; i++) {
+    for (uint32_t i = min; i < limit; i++) {
         if (!bitmap_test(i)) {
             if (found == 0) {
                 start = i;
@@ -80,18 +522,65 @@ static uint32_t bitmap_find_free_contiguous(uint32_t count) {
     return (uint32_t)-1;  /* Not enough contiguous pages */
 }
 
+static void pmm_free_range(uint32_t page, uint32_t end);
+
+/**
+ * Highest available page in the memory map (capped at MAX_PAGES), rounded
+ * up to LIMIT_GRANULE, so pmm_init clears no more map than the machine needs
+ */
+static uint32_t pmm_scan_limit(multiboot_info_t* mboot) {
+    uint64_t top = (uint64_t)(mboot->mem_upper + 1024) * 1024;
+    
+    if (mboot->flags & MULTIBOOT_INFO_MEM_MAP) {
+        multiboot_mmap_entry_t* mmap = (multiboot_mmap_entry_t*)mboot->mmap_addr;
+        multiboot_mmap_entry_t* mmap_end = (multiboot_mmap_entry_t*)(mboot->mmap_addr + mboot->mmap_length);
+        
+        top = 0;
+        while (mmap < mmap_end) {
+            if (mmap->type == MULTIBOOT_MEMORY_AVAILABLE && mmap->addr + mmap->len > top) {
+                top = mmap->addr + mmap->len;
+            }
+            mmap = (multiboot_mmap_entry_t*)((uint32_t)mmap + mmap->size + sizeof(mmap->size));
+        }
+    }
+    
+    if (top > MAX_MEMORY) {
+        top = MAX_MEMORY;
+    }
+    uint32_t pages = (uint32_t)(top / PAGE_SIZE);
+    return (pages + LIMIT_GRANULE - 1) / LIMIT_GRANULE * LIMIT_GRANULE;
+}
+
 /**
  * Initialize the physical memory manager
  */
 void pmm_init(multiboot_info_t* mboot) {
+    /* Clear maps up to this machine's limit, and past it what a previous init used */
+    uint32_t previous_limit = limit_pages;
+    limit_pages = pmm_scan_limit(mboot);
+    uint32_t clear_words = ((limit_pages > previous_limit) ? limit_pages : previous_limit) / 32;
+    
     /* Start by marking all memory as used */
-    memset(pmm_bitmap, 0xFF, sizeof(pmm_bitmap));
+    memset(pmm_bitmap, 0xFF, clear_words * sizeof(uint32_t));
+    memset(pmm_summary_l1, 0xFF, clear_words / 32 * sizeof(uint32_t));
+    memset(pmm_summary_l2, 0xFF, clear_words / 1024 * sizeof(uint32_t));
+    next_fit_hint = DMA_MEMORY_PAGES;
+    high_fit_hint = LOW_MEMORY_PAGES;
+    total_memory = 0;
+    usable_ranges = 0;
+    buddy_init(clear_words);
+    memset(pmm_magazines, 0, sizeof(pmm_magazines));
+    memset(pmm_zero_pools, 0, sizeof(pmm_zero_pools));
+    uint32_t parked_words = (clear_words < PARKED_MAP_WORDS) ? clear_words : PARKED_MAP_WORDS;
+    memset(pmm_parked_map, 0, parked_words * sizeof(uint32_t));
     
     /* Check if memory map is available */
     if (!(mboot->flags & MULTIBOOT_INFO_MEM_MAP)) {
         /* No memory map - use basic memory info */
-        total_memory = (mboot->mem_upper + 1024) * 1024;  /* mem_upper is in KB, starting at 1MB */
-        total_pages = total_memory / PAGE_SIZE;
+        total_memory = (uint64_t)(mboot->mem_upper + 1024) * 1024;  /* mem_upper is in KB, starting at 1MB */
+        total_pages = (uint32_t)(total_memory / PAGE_SIZE);
+        low_pages = (total_pages < LOW_MEMORY_PAGES) ? total_pages : LOW_MEMORY_PAGES;
+        dma_pages = (total_pages < DMA_MEMORY_PAGES) ? total_pages : DMA_MEMORY_PAGES;
         used_pages = total_pages;
         return;
     }
@@ -118,11 +607,19 @@ void pmm_init(multiboot_info_t* mboot) {
             if (start < end) {
                 /* Update total memory */
                 if (end > total_memory) {
-                    total_memory = (uint32_t)end;
+                    total_memory = end;
                 }
                 
-                /* Mark region as free */
-                pmm_mark_region_free((uint32_t)start, (uint32_t)(end - start));
+                /* Mark region as free (whole pages only) */
+                uint32_t first = (uint32_t)((start + PAGE_SIZE - 1) / PAGE_SIZE);
+                uint32_t last = (uint32_t)(end / PAGE_SIZE);
+                if (first < last && usable_ranges < PMM_MAX_RANGES) {
+                    usable_start[usable_ranges] = first;
+                    usable_end[usable_ranges++] = last;
+                } else if (first < LOW_MEMORY_PAGES) {
+                    first = LOW_MEMORY_PAGES;  /* Would be missing from the direct map */
+                }
+                pmm_free_range(first, last);
             }
         }
         
@@ -131,7 +628,9 @@ void pmm_init(multiboot_info_t* mboot) {
     }
     
     /* Calculate total pages */
-    total_pages = total_memory / PAGE_SIZE;
+    total_pages = (uint32_t)(total_memory / PAGE_SIZE);
+    low_pages = (total_pages < LOW_MEMORY_PAGES) ? total_pages : LOW_MEMORY_PAGES;
+    dma_pages = (total_pages < DMA_MEMORY_PAGES) ? total_pages : DMA_MEMORY_PAGES;
     
     /* Mark kernel region as used */
     uint32_t kernel_start = (uint32_t)&_kernel_start;
@@ -142,31 +641,232 @@ void pmm_init(multiboot_info_t* mboot) {
     pmm_mark_region_used(0, 0x100000);
     
     /* Count used pages */
-    used_pages = 0;
-    for (uint32_t i = 0; i < total_pages; i++) {
-        if (bitmap_test(i)) {
-            used_pages++;
-        }
+    used_pages = bitmap_count_used(total_pages);
+}
+
+/**
+ * Take a free page out of the shared maps
+ */
+static inline void pmm_claim_page(uint32_t page) {
+    bitmap_set(page);
+    buddy_remove_page(page);
+    used_pages++;
+}
+
+/**
+ * Test if a low-memory page is parked in a per-CPU cache
+ */
+static inline bool pmm_parked(uint32_t page) {
+    return (pmm_parked_map[page / 32] & (1U << (page % 32))) != 0;
+}
+
+/**
+ * Mark a low-memory page as parked in, or taken out of, a per-CPU cache
+ */
+static inline void pmm_park(uint32_t page) {
+    pmm_parked_map[page / 32] |= 1U << (page % 32);
+}
+
+static inline uint32_t pmm_unpark(uint32_t page) {
+    pmm_parked_map[page / 32] &= ~(1U << (page % 32));
+    return page;
+}
+
+/**
+ * Take a free low-memory page from the shared maps
+ * @return Page number, or (uint32_t)-1 when out of memory
+ */
+static uint32_t pmm_take_page(void) {
+    uint32_t page = bitmap_find_free();
+    if (page == (uint32_t)-1) {
+        return page;
+    }
+    
+    pmm_claim_page(page);
+    if (page >= dma_pages) {
+        next_fit_hint = page + 1;  /* DMA zone fallbacks don't move the hint */
+    }
+    
+    return page;
+}
+
+/**
+ * Give a used page back to the shared maps
+ */
+static void pmm_return_page(uint32_t page) {
+    bitmap_clear(page);
+    buddy_insert(page, 0);
+    used_pages--;
+}
+
+/**
+ * Return the oldest count pages of a magazine to the shared maps
+ */
+static void pmm_magazine_drain(pmm_magazine_t* mag, uint32_t count) {
+    if (count > mag->count) {
+        count = mag->count;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        pmm_return_page(pmm_unpark(mag->pages[i]));
+    }
+    mag->count -= count;
+    for (uint32_t i = 0; i < mag->count; i++) {
+        mag->pages[i] = mag->pages[i + count];
     }
 }
 
 /**
  * Allocate a single physical page
+ * Served from this CPU's magazine; an empty magazine is refilled with
+ * PMM_MAG_BATCH pages from the shared maps
  */
 uint32_t pmm_alloc_page(void) {
-    uint32_t page = bitmap_find_free();
+    pmm_magazine_t* mag = &pmm_magazines[cpu_id()];
+    
+    if (mag->count == 0) {
+        while (mag->count < PMM_MAG_BATCH) {
+            uint32_t page = pmm_take_page();
+            if (page == (uint32_t)-1) {
+                break;
+            }
+            pmm_park(page);
+            mag->pages[mag->count++] = page;
+        }
+        if (mag->count == 0) {
+            /* Last resort: a pre-zeroed page */
+            pmm_zero_pool_t* pool = &pmm_zero_pools[cpu_id()];
+            if (pool->count == 0) {
+                return 0;  /* Out of memory */
+            }
+            return PAGE_TO_ADDR(pmm_unpark(pool->pages[--pool->count]));
+        }
+    }
+    
+    return PAGE_TO_ADDR(pmm_unpark(mag->pages[--mag->count]));
+}
+
+/**
+ * Allocate a page anywhere, high zone first
+ * High pages bypass the magazines, which only hold pages with 32-bit addresses
+ */
+phys_addr_t pmm_alloc_page64(void) {
+    uint32_t page = bitmap_find_free_from(high_fit_hint);
+    if (page == (uint32_t)-1 && high_fit_hint > LOW_MEMORY_PAGES) {
+        page = bitmap_find_free_from(LOW_MEMORY_PAGES);
+    }
     if (page == (uint32_t)-1) {
-        return 0;  /* Out of memory */
+        return pmm_alloc_page();  /* Nothing in the high zone */
     }
     
-    bitmap_set(page);
-    used_pages++;
+    pmm_claim_page(page);
+    high_fit_hint = page + 1;
+    return (phys_addr_t)page << PAGE_SHIFT;
+}
+
+/**
+ * Free a page from pmm_alloc_page64()
+ */
+void pmm_free_page64(phys_addr_t addr) {
+    if (addr < (phys_addr_t)LOW_MEMORY_PAGES << PAGE_SHIFT) {
+        pmm_free_page((uint32_t)addr);
+        return;
+    }
     
-    return PAGE_TO_ADDR(page);
+    uint32_t page = (uint32_t)(addr >> PAGE_SHIFT);
+    if (page < total_pages && bitmap_test(page)) {
+        pmm_return_page(page);
+    }
+}
+
+/**
+ * Allocate a zeroed physical page
+ * Takes a page the idle loop has already cleared when one is pooled,
+ * otherwise clears a normal page here through the direct map. Safe to call
+ * from the page fault handler: no new mapping is needed
+ */
+uint32_t pmm_alloc_zeroed_page(void) {
+    pmm_zero_pool_t* pool = &pmm_zero_pools[cpu_id()];
+    if (pool->count > 0) {
+        return PAGE_TO_ADDR(pmm_unpark(pool->pages[--pool->count]));
+    }
+    
+    uint32_t addr = pmm_alloc_page();
+    if (addr != 0) {
+        memset(pmm_to_virt(addr), 0, PAGE_SIZE);
+    }
+    return addr;
+}
+
+/**
+ * Zero one free page into this CPU's pool, for the idle loop
+ * One page per call keeps the delay before the next HLT short. Pool pages
+ * are low memory, so they are cleared through the direct map
+ */
+bool pmm_zero_idle(void) {
+    pmm_zero_pool_t* pool = &pmm_zero_pools[cpu_id()];
+    if (pool->count == PMM_ZERO_POOL_SIZE) {
+        return false;
+    }
+    
+    uint32_t page = pmm_take_page();
+    if (page == (uint32_t)-1) {
+        return false;
+    }
+    memset(pmm_to_virt(PAGE_TO_ADDR(page)), 0, PAGE_SIZE);
+    pmm_park(page);
+    pool->pages[pool->count++] = page;
+    return true;
+}
+
+/**
+ * Allocate count contiguous pages inside [min, limit)
+ * Runs of up to 2^PMM_MAX_ORDER pages come from the buddy allocator; the
+ * unused tail of the power-of-two block is freed straight away. Larger
+ * runs, or any run when no aligned block is free, use a bitmap search
+ * unless buddy_only is set
+ * @return First page, or (uint32_t)-1
+ */
+static uint32_t pmm_alloc_run(uint32_t count, uint32_t min, uint32_t limit, bool buddy_only) {
+    uint32_t order = 0;
+    while (order <= PMM_MAX_ORDER && (1U << order) < count) {
+        order++;
+    }
+    
+    uint32_t start = (uint32_t)-1;
+    if (order <= PMM_MAX_ORDER) {
+        start = buddy_alloc(order, min, limit);
+    }
+    if (start == (uint32_t)-1 && pmm_get_cached_pages() > 0) {
+        /* Pages parked in this CPU's magazine or zero pool may complete a run */
+        pmm_drain_local();
+        if (order <= PMM_MAX_ORDER) {
+            start = buddy_alloc(order, min, limit);
+        }
+    }
+    if (start != (uint32_t)-1) {
+        buddy_insert_range(start + count, start + (1U << order));
+    } else {
+        /* Too large for one block, or no aligned block left: search runs */
+        if (buddy_only) {
+            return (uint32_t)-1;
+        }
+        start = bitmap_find_free_contiguous(count, min, limit);
+        if (start == (uint32_t)-1) {
+            return start;  /* Not enough contiguous memory */
+        }
+        buddy_remove_range(start, start + count);
+    }
+    
+    /* Mark all pages as used */
+    bitmap_set_range(start, start + count);
+    used_pages += count;
+    
+    return start;
 }
 
 /**
  * Allocate multiple contiguous physical pages
+ * Tries the normal zone, then all of low memory
  */
 uint32_t pmm_alloc_pages(uint32_t count) {
     if (count == 0) {
@@ -176,32 +876,69 @@ uint32_t pmm_alloc_pages(uint32_t count) {
         return pmm_alloc_page();
     }
     
-    uint32_t start = bitmap_find_free_contiguous(count);
+    uint32_t start = pmm_alloc_run(count, dma_pages, low_pages, false);
     if (start == (uint32_t)-1) {
-        return 0;  /* Not enough contiguous memory */
+        start = pmm_alloc_run(count, 0, low_pages, false);
     }
-    
-    /* Mark all pages as used */
-    for (uint32_t i = 0; i < count; i++) {
-        bitmap_set(start + i);
-        used_pages++;
+    return (start != (uint32_t)-1) ? PAGE_TO_ADDR(start) : 0;
+}
+
+/**
+ * Allocate contiguous pages below 16MB for ISA DMA
+ * Runs of 16 pages or fewer must come from a buddy block to stay inside
+ * one 64KB DMA page
+ */
+uint32_t pmm_alloc_dma_pages(uint32_t count) {
+    if (count == 0) {
+        return 0;
     }
     
-    return PAGE_TO_ADDR(start);
+    uint32_t start = pmm_alloc_run(count, 0, dma_pages, count <= 16);
+    return (start != (uint32_t)-1) ? PAGE_TO_ADDR(start) : 0;
 }
 
 /**
  * Free a physical page
+ * The page goes to this CPU's magazine; a full magazine first returns
+ * its oldest PMM_MAG_BATCH pages to the shared maps. Freeing a page that
+ * is already free, in the maps or parked, does nothing
  */
 void pmm_free_page(uint32_t addr) {
     uint32_t page = ADDR_TO_PAGE(addr);
-    if (page >= total_pages) {
+    if (page >= total_pages || !bitmap_test(page)) {
+        return;
+    }
+    if (page >= low_pages) {
+        pmm_return_page(page);  /* High pages are never parked */
+        return;
+    }
+    if (pmm_parked(page)) {
         return;
     }
     
-    if (bitmap_test(page)) {
-        bitmap_clear(page);
-        used_pages--;
+    pmm_magazine_t* mag = &pmm_magazines[cpu_id()];
+    if (mag->count == PMM_MAG_SIZE) {
+        pmm_magazine_drain(mag, PMM_MAG_BATCH);
+    }
+    pmm_park(page);
+    mag->pages[mag->count++] = page;
+}
+
+/**
+ * Free the used pages in [page, end), one run of used pages at a time
+ * Parked pages are marked used but already free, so runs stop at them
+ */
+static void pmm_free_range(uint32_t page, uint32_t end) {
+    while ((page = bitmap_scan(page, end, true)) < end) {
+        uint32_t run_end = parked_scan(page, bitmap_scan(page, end, false));
+        if (run_end == page) {
+            page++;
+            continue;
+        }
+        bitmap_clear_range(page, run_end);
+        buddy_insert_range(page, run_end);
+        used_pages -= run_end - page;
+        page = run_end;
     }
 }
 
@@ -209,9 +946,14 @@ void pmm_free_page(uint32_t addr) {
  * Free multiple contiguous physical pages
  */
 void pmm_free_pages(uint32_t addr, uint32_t count) {
-    for (uint32_t i = 0; i < count; i++) {
-        pmm_free_page(addr + i * PAGE_SIZE);
+    uint32_t page = ADDR_TO_PAGE(addr);
+    if (page >= total_pages) {
+        return;
     }
+    if (count > total_pages - page) {
+        count = total_pages - page;
+    }
+    pmm_free_range(page, page + count);
 }
 
 /**
@@ -219,22 +961,33 @@ void pmm_free_pages(uint32_t addr, uint32_t count) {
  */
 void pmm_mark_used(uint32_t addr) {
     uint32_t page = ADDR_TO_PAGE(addr);
+    pmm_drain_local();
     if (page < total_pages && !bitmap_test(page)) {
         bitmap_set(page);
+        buddy_remove_page(page);
         used_pages++;
     }
 }
 
 /**
- * Mark a region as used
+ * Mark a region as used, one run of free pages at a time
  */
 void pmm_mark_region_used(uint32_t start, uint32_t size) {
-    uint32_t addr = PAGE_ALIGN_DOWN(start);
-    uint32_t end = PAGE_ALIGN_UP(start + size);
+    uint32_t page = ADDR_TO_PAGE(PAGE_ALIGN_DOWN(start));
+    uint32_t end = ADDR_TO_PAGE(PAGE_ALIGN_UP(start + size));
+    if (end > total_pages) {
+        end = total_pages;
+    }
+    
+    /* A parked page must not be handed out after it is reserved */
+    pmm_drain_local();
     
-    while (addr < end) {
-        pmm_mark_used(addr);
-        addr += PAGE_SIZE;
+    while ((page = bitmap_scan(page, end, false)) < end) {
+        uint32_t run_end = bitmap_scan(page, end, true);
+        buddy_remove_range(page, run_end);
+        bitmap_set_range(page, run_end);
+        used_pages += run_end - page;
+        page = run_end;
     }
 }
 
@@ -242,35 +995,161 @@ void pmm_mark_region_used(uint32_t start, uint32_t size) {
  * Mark a region as free
  */
 void pmm_mark_region_free(uint32_t start, uint32_t size) {
-    uint32_t addr = PAGE_ALIGN_UP(start);
-    uint32_t end = PAGE_ALIGN_DOWN(start + size);
-    
-    while (addr < end) {
-        uint32_t page = ADDR_TO_PAGE(addr);
-        if (page < MAX_PAGES) {
-            bitmap_clear(page);
-        }
-        addr += PAGE_SIZE;
+    uint32_t page = ADDR_TO_PAGE(PAGE_ALIGN_UP(start));
+    uint32_t end = ADDR_TO_PAGE(PAGE_ALIGN_DOWN(start + size));
+    if (end > limit_pages) {
+        end = limit_pages;
     }
+    
+    pmm_free_range(page, end);
 }
 
 /**
  * Get total physical memory in bytes
  */
-uint32_t pmm_get_total_memory(void) {
+uint64_t pmm_get_total_memory(void) {
     return total_memory;
 }
 
 /**
  * Get free physical memory in bytes
  */
-uint32_t pmm_get_free_memory(void) {
-    return (total_pages - used_pages) * PAGE_SIZE;
+uint64_t pmm_get_free_memory(void) {
+    return (uint64_t)(total_pages - used_pages + pmm_get_cached_pages()) * PAGE_SIZE;
 }
 
 /**
  * Get used physical memory in bytes
  */
-uint32_t pmm_get_used_memory(void) {
-    return used_pages * PAGE_SIZE;
+uint64_t pmm_get_used_memory(void) {
+    return (uint64_t)(used_pages - pmm_get_cached_pages()) * PAGE_SIZE;
+}
+
+/**
+ * Return this CPU's magazine and zero pool pages to the shared maps
+ */
+void pmm_drain_local(void) {
+    pmm_magazine_t* mag = &pmm_magazines[cpu_id()];
+    pmm_zero_pool_t* pool = &pmm_zero_pools[cpu_id()];
+    
+    pmm_magazine_drain(mag, mag->count);
+    while (pool->count > 0) {
+        pmm_return_page(pmm_unpark(pool->pages[--pool->count]));
+    }
+}
+
+/**
+ * Get the number of free pages parked in per-CPU magazines and zero pools
+ */
+uint32_t pmm_get_cached_pages(void) {
+    uint32_t cached = 0;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        cached += pmm_magazines[cpu].count + pmm_zero_pools[cpu].count;
+    }
+    return cached;
+}
+
+/**
+ * Get the number of pre-zeroed pages waiting in the zero pools
+ */
+uint32_t pmm_get_zeroed_pages(void) {
+    uint32_t zeroed = 0;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        zeroed += pmm_zero_pools[cpu].count;
+    }
+    return zeroed;
+}
+
+/**
+ * Get statistics for a zone
+ * Free pages are counted from the bitmap, plus per-CPU cached pages
+ * that fall inside the zone
+ */
+bool pmm_get_zone_info(uint32_t zone, pmm_zone_info_t* info) {
+    static const uint32_t zone_start[PMM_ZONES] = { 0, DMA_MEMORY_PAGES, LOW_MEMORY_PAGES };
+    static const uint32_t zone_end[PMM_ZONES] = { DMA_MEMORY_PAGES, LOW_MEMORY_PAGES, MAX_PAGES };
+    
+    if (zone >= PMM_ZONES) {
+        return false;
+    }
+    
+    uint32_t start = (zone_start[zone] < total_pages) ? zone_start[zone] : total_pages;
+    uint32_t end = (zone_end[zone] < total_pages) ? zone_end[zone] : total_pages;
+    uint32_t used = bitmap_count_used(end) - bitmap_count_used(start);
+    uint32_t cached = 0;
+    
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        for (uint32_t i = 0; i < pmm_magazines[cpu].count; i++) {
+            uint32_t page = pmm_magazines[cpu].pages[i];
+            cached += (page >= start && page < end);
+        }
+        for (uint32_t i = 0; i < pmm_zero_pools[cpu].count; i++) {
+            uint32_t page = pmm_zero_pools[cpu].pages[i];
+            cached += (page >= start && page < end);
+        }
+    }
+    
+    info->name = zone_names[zone];
+    info->start = (phys_addr_t)start << PAGE_SHIFT;
+    info->end = (phys_addr_t)end << PAGE_SHIFT;
+    info->free_pages = (end - start) - used + cached;
+    return true;
+}
+
+/**
+ * Get a usable range of the boot memory map
+ */
+bool pmm_get_usable_range(uint32_t index, phys_addr_t* start, phys_addr_t* end) {
+    if (index >= usable_ranges) {
+        return false;
+    }
+    *start = (phys_addr_t)usable_start[index] << PAGE_SHIFT;
+    *end = (phys_addr_t)usable_end[index] << PAGE_SHIFT;
+    return true;
+}
+
+/**
+ * Get the number of free buddy blocks of each order
+ */
+void pmm_get_free_blocks(uint32_t* counts) {
+    for (uint32_t k = 0; k < BUDDY_ORDERS; k++) {
+        counts[k] = buddy_free_blocks[k];
+    }
+}
+
+/**
+ * Get the longest run of free pages
+ * Whole free words add 32 pages to the current run; a word with used pages
+ * ends the run at its lowest used page, and its highest used page starts the next
+ */
+uint32_t pmm_get_largest_free_run(void) {
+    uint32_t best = 0;
+    uint32_t run = 0;
+    
+    for (uint32_t w = 0; w < limit_pages / 32; w++) {
+        uint32_t bits = pmm_bitmap[w];
+        if (bits == 0) {
+            run += 32;
+            continue;
+        }
+        
+        run += __builtin_ctz(bits);
+        if (run > best) {
+            best = run;
+        }
+        
+        /* Gaps between used pages inside the word */
+        uint32_t prev = __builtin_ctz(bits);
+        bits &= bits - 1;
+        while (bits != 0) {
+            uint32_t next = __builtin_ctz(bits);
+            if (next - prev - 1 > best) {
+                best = next - prev - 1;
+            }
+            prev = next;
+            bits &= bits - 1;
+        }
+        run = 31 - prev;
+    }
+    return (run > best) ? run : best;
 }
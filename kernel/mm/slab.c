@@ -0,0 +1,409 @@
+/**
+ * TarkOS - Slab Allocator Implementation
+ * Each slab is one PMM page: a header, a byte-index free list, then the
+ * objects. Keeping the free list out of the objects lets constructed
+ * state survive free/alloc cycles. kfree() finds the slab by rounding
+ * the pointer down to its page, so objects carry no per-object header.
+ * Allocation and free go through a per-CPU magazine of objects in each
+ * cache; only refills and drains touch the shared slab lists.
+ */
+
+#include <kernel/slab.h>
+#include <kernel/pmm.h>
+#include <kernel/percpu.h>
+#include <lib/string.h>
+
+#define SLAB_MAGIC          0x51AB51AB
+#define BIG_MAGIC           0xB16B16B1
+#define SLAB_END            0xFF        /* Free list terminator */
+#define SLAB_MAX_OBJS       255
+#define SLAB_DEFAULT_ALIGN  8
+#define KMALLOC_ALIGN       16
+#define KMALLOC_LIMIT       0x40000000  /* Largest request; keeps the page count from overflowing */
+
+/**
+ * Slab header, at the start of its page
+ */
+typedef struct slab {
+    uint32_t magic;
+    kmem_cache_t* cache;
+    struct slab* next;
+    struct slab* prev;
+    uint32_t inuse;
+    uint8_t free_index;         /* First free object, or SLAB_END */
+    uint8_t free_next[];        /* Next free object, per object */
+} slab_t;
+
+/**
+ * Header of a kmalloc block too large for the size classes
+ */
+typedef struct big_block {
+    uint32_t magic;
+    uint32_t pages;
+} big_block_t;
+
+/**
+ * Per-CPU object magazine; counters live here so the fast path only
+ * writes this CPU's line
+ */
+typedef struct slab_magazine {
+    uint32_t count;
+    uint32_t allocs;
+    uint32_t frees;
+    void* objs[SLAB_MAG_SIZE];
+} CACHE_ALIGNED slab_magazine_t;
+
+struct kmem_cache {
+    slab_magazine_t mags[MAX_CPUS];
+    const char* name;
+    uint32_t size;
+    uint32_t objs_per_slab;
+    uint32_t obj_offset;        /* First object, from the slab header */
+    slab_ctor_t ctor;
+    slab_t* partial;            /* Slabs with free and used objects */
+    slab_t* full;               /* Slabs with no free objects */
+    slab_t* empty;              /* At most one fully free slab is kept */
+    uint32_t slabs;
+    uint32_t failures;
+};
+
+static kmem_cache_t caches[SLAB_MAX_CACHES];
+static uint32_t cache_count = 0;
+static kmem_cache_t* kmalloc_caches[KMALLOC_CLASSES];
+
+static const char* kmalloc_names[KMALLOC_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048"
+};
+
+/**
+ * Slab that owns an object (or the page of a big block)
+ */
+static inline slab_t* slab_of(void* obj) {
+    return (slab_t*)PAGE_ALIGN_DOWN((uint32_t)obj);
+}
+
+static inline uint8_t* slab_obj(kmem_cache_t* cache, slab_t* slab, uint32_t index) {
+    return (uint8_t*)slab + cache->obj_offset + index * cache->size;
+}
+
+static void slab_list_add(slab_t** head, slab_t* slab) {
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head) {
+        (*head)->prev = slab;
+    }
+    *head = slab;
+}
+
+static void slab_list_remove(slab_t** head, slab_t* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *head = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+/**
+ * Take a page from the PMM and lay out a fresh slab on it
+ */
+static slab_t* slab_grow(kmem_cache_t* cache) {
+    uint32_t addr = pmm_alloc_page();
+    if (addr == 0) {
+        return NULL;
+    }
+    
+    slab_t* slab = pmm_to_virt(addr);
+    slab->magic = SLAB_MAGIC;
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->free_index = 0;
+    
+    for (uint32_t i = 0; i < cache->objs_per_slab; i++) {
+        slab->free_next[i] = (i + 1 < cache->objs_per_slab) ? i + 1 : SLAB_END;
+        if (cache->ctor) {
+            cache->ctor(slab_obj(cache, slab, i));
+        }
+    }
+    
+    cache->slabs++;
+    return slab;
+}
+
+/**
+ * Give an empty slab's page back to the PMM
+ */
+static void slab_release(kmem_cache_t* cache, slab_t* slab) {
+    slab->magic = 0;
+    pmm_free_page(pmm_to_phys(slab));
+    cache->slabs--;
+}
+
+/**
+ * Initialize the slab allocator and the kmalloc caches
+ */
+void slab_init(void) {
+    cache_count = 0;
+    
+    uint32_t size = KMALLOC_MIN_SIZE;
+    for (uint32_t i = 0; i < KMALLOC_CLASSES; i++) {
+        kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], size,
+                                              KMALLOC_ALIGN, NULL);
+        size <<= 1;
+    }
+}
+
+/**
+ * Create an object cache
+ */
+kmem_cache_t* kmem_cache_create(const char* name, uint32_t size, uint32_t align,
+                                slab_ctor_t ctor) {
+    if (cache_count >= SLAB_MAX_CACHES || size == 0 || size > PAGE_SIZE) {
+        return NULL;
+    }
+    if (align == 0) {
+        align = SLAB_DEFAULT_ALIGN;
+    }
+    size = ALIGN_UP(size, align);
+    
+    /* Most objects that fit after the header and one index byte each */
+    uint32_t objs = (PAGE_SIZE - sizeof(slab_t)) / (size + 1);
+    if (objs > SLAB_MAX_OBJS) {
+        objs = SLAB_MAX_OBJS;
+    }
+    while (objs > 0 &&
+           ALIGN_UP(sizeof(slab_t) + objs, align) + objs * size > PAGE_SIZE) {
+        objs--;
+    }
+    if (objs == 0) {
+        return NULL;
+    }
+    
+    kmem_cache_t* cache = &caches[cache_count++];
+    cache->name = name;
+    cache->size = size;
+    cache->objs_per_slab = objs;
+    cache->obj_offset = ALIGN_UP(sizeof(slab_t) + objs, align);
+    cache->ctor = ctor;
+    cache->partial = NULL;
+    cache->full = NULL;
+    cache->empty = NULL;
+    cache->slabs = 0;
+    cache->failures = 0;
+    memset(cache->mags, 0, sizeof(cache->mags));
+    
+    return cache;
+}
+
+/**
+ * Fill a magazine with up to SLAB_MAG_BATCH objects from the cache's
+ * slabs, taking as many as each slab has before moving to the next
+ */
+static void slab_refill(kmem_cache_t* cache, slab_magazine_t* mag) {
+    while (mag->count < SLAB_MAG_BATCH) {
+        slab_t* slab = cache->partial;
+        
+        if (!slab) {
+            slab = cache->empty;
+            if (slab) {
+                cache->empty = NULL;
+            } else if (!(slab = slab_grow(cache))) {
+                return;
+            }
+            slab_list_add(&cache->partial, slab);
+        }
+        
+        while (mag->count < SLAB_MAG_BATCH && slab->inuse < cache->objs_per_slab) {
+            uint32_t index = slab->free_index;
+            slab->free_index = slab->free_next[index];
+            slab->inuse++;
+            mag->objs[mag->count++] = slab_obj(cache, slab, index);
+        }
+        if (slab->inuse == cache->objs_per_slab) {
+            slab_list_remove(&cache->partial, slab);
+            slab_list_add(&cache->full, slab);
+        }
+    }
+}
+
+/**
+ * Put an object back on its slab
+ */
+static void slab_free_obj(kmem_cache_t* cache, void* obj) {
+    slab_t* slab = slab_of(obj);
+    uint32_t index = ((uint8_t*)obj - slab_obj(cache, slab, 0)) / cache->size;
+    slab->free_next[index] = slab->free_index;
+    slab->free_index = index;
+    
+    if (slab->inuse == cache->objs_per_slab) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_add(&cache->partial, slab);
+    }
+    slab->inuse--;
+    if (slab->inuse == 0) {
+        slab_list_remove(&cache->partial, slab);
+        if (cache->empty) {
+            slab_release(cache, slab);
+        } else {
+            cache->empty = slab;
+        }
+    }
+}
+
+/**
+ * Return the oldest count objects of a magazine to their slabs
+ */
+static void slab_magazine_drain(kmem_cache_t* cache, slab_magazine_t* mag,
+                                uint32_t count) {
+    if (count > mag->count) {
+        count = mag->count;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        slab_free_obj(cache, mag->objs[i]);
+    }
+    mag->count -= count;
+    for (uint32_t i = 0; i < mag->count; i++) {
+        mag->objs[i] = mag->objs[i + count];
+    }
+}
+
+/**
+ * Allocate an object from a cache
+ * Served from this CPU's magazine; an empty magazine is refilled with
+ * SLAB_MAG_BATCH objects from the slabs
+ */
+void* kmem_cache_alloc(kmem_cache_t* cache) {
+    slab_magazine_t* mag = &cache->mags[cpu_id()];
+    
+    if (mag->count == 0) {
+        slab_refill(cache, mag);
+        if (mag->count == 0) {
+            cache->failures++;
+            return NULL;
+        }
+    }
+    
+    mag->allocs++;
+    return mag->objs[--mag->count];
+}
+
+/**
+ * Return an object to its cache
+ * The object goes to this CPU's magazine; a full magazine first returns
+ * its oldest SLAB_MAG_BATCH objects to the slabs
+ */
+void kmem_cache_free(kmem_cache_t* cache, void* obj) {
+    slab_t* slab = slab_of(obj);
+    if (slab->magic != SLAB_MAGIC || slab->cache != cache) {
+        return;  /* Not an object of this cache */
+    }
+    
+    slab_magazine_t* mag = &cache->mags[cpu_id()];
+    if (mag->count == SLAB_MAG_SIZE) {
+        slab_magazine_drain(cache, mag, SLAB_MAG_BATCH);
+    }
+    mag->objs[mag->count++] = obj;
+    mag->frees++;
+}
+
+/**
+ * Return this CPU's magazine objects in every cache to their slabs
+ */
+void slab_drain_local(void) {
+    for (uint32_t i = 0; i < cache_count; i++) {
+        slab_magazine_t* mag = &caches[i].mags[cpu_id()];
+        slab_magazine_drain(&caches[i], mag, mag->count);
+    }
+}
+
+/**
+ * Size class for a kmalloc request (size <= KMALLOC_MAX_SIZE)
+ */
+static inline uint32_t kmalloc_class(size_t size) {
+    if (size <= KMALLOC_MIN_SIZE) {
+        return 0;
+    }
+    return 32 - __builtin_clz(size - 1) - 4;
+}
+
+/**
+ * Allocate size bytes
+ */
+void* kmalloc(size_t size) {
+    if (size == 0 || size > KMALLOC_LIMIT) {
+        return NULL;
+    }
+    if (size <= KMALLOC_MAX_SIZE) {
+        return kmem_cache_alloc(kmalloc_caches[kmalloc_class(size)]);
+    }
+    
+    /* Whole pages, with the block header ahead of the data */
+    uint32_t pages = (size + KMALLOC_ALIGN + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t addr = pmm_alloc_pages(pages);
+    if (addr == 0) {
+        return NULL;
+    }
+    
+    big_block_t* block = pmm_to_virt(addr);
+    block->magic = BIG_MAGIC;
+    block->pages = pages;
+    return (uint8_t*)block + KMALLOC_ALIGN;
+}
+
+/**
+ * Free a block from kmalloc
+ */
+void kfree(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    
+    slab_t* slab = slab_of(ptr);
+    if (slab->magic == SLAB_MAGIC) {
+        kmem_cache_free(slab->cache, ptr);
+        return;
+    }
+    
+    big_block_t* block = (big_block_t*)slab;
+    if (block->magic == BIG_MAGIC) {
+        block->magic = 0;
+        pmm_free_pages(pmm_to_phys(block), block->pages);
+    }
+}
+
+/**
+ * Get statistics for a cache
+ */
+bool slab_get_stats(uint32_t index, slab_stats_t* stats) {
+    if (index >= cache_count) {
+        return false;
+    }
+    
+    kmem_cache_t* cache = &caches[index];
+    stats->name = cache->name;
+    stats->obj_size = cache->size;
+    stats->objs_per_slab = cache->objs_per_slab;
+    stats->slabs = cache->slabs;
+    stats->total_objs = cache->slabs * cache->objs_per_slab;
+    stats->cached_objs = 0;
+    stats->allocs = 0;
+    stats->frees = 0;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        stats->cached_objs += cache->mags[cpu].count;
+        stats->allocs += cache->mags[cpu].allocs;
+        stats->frees += cache->mags[cpu].frees;
+    }
+    stats->active_objs = stats->allocs - stats->frees;
+    stats->failures = cache->failures;
+    return true;
+}
+
+/**
+ * Get the number of caches
+ */
+uint32_t slab_cache_count(void) {
+    return cache_count;
+}
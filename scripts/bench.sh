@@ -0,0 +1,94 @@
+#!/bin/bash
+#
+# TarkOS Benchmark Regression Runner
+# Boots the bench ISO headless in QEMU, collects the in-kernel `bench`
+# results from COM1 and compares the medians against a baseline.
+#
+# Usage: ./bench.sh <iso> <baseline.csv> <tolerance%> [--update]
+#   --update  Replace the baseline with the results of this run
+#   Baselines are machine-specific and are not committed (see .gitignore)
+#
+
+set -e
+
+ISO="$1"
+BASELINE="$2"
+TOLERANCE="${3:-25}"
+UPDATE="$4"
+
+OUT_DIR="build/bench"
+SERIAL_LOG="$OUT_DIR/serial.log"
+RESULTS="$OUT_DIR/results.csv"
+TIMEOUT=120
+
+mkdir -p "$OUT_DIR"
+rm -f "$SERIAL_LOG"
+
+echo "[1/3] Booting $ISO in QEMU (headless)..."
+# isa-debug-exit turns the kernel's "outb(0xF4, 0)" into exit status 1
+set +e
+timeout $TIMEOUT qemu-system-i386 -cdrom "$ISO" -m 512M \
+    -display none -no-reboot \
+    -serial file:"$SERIAL_LOG" \
+    -device isa-debug-exit,iobase=0xf4,iosize=0x04
+STATUS=$?
+set -e
+if [ $STATUS -eq 124 ]; then
+    echo "Error: QEMU did not exit within ${TIMEOUT}s"
+    exit 1
+fi
+if [ $STATUS -ne 1 ]; then
+    echo "Error: QEMU exited with status $STATUS (expected 1 from isa-debug-exit)"
+    exit 1
+fi
+
+echo "[2/3] Parsing results into $RESULTS..."
+# Table rows look like: "memcpy-16K    27822   27856   27896   588 MB/s"
+awk '
+    /TarkOS bench begin/ { inside = 1; next }
+    /TarkOS bench end/   { inside = 0; done = 1 }
+    inside && /^error:/  { print > "/dev/stderr"; exit 2 }
+    inside && NF == 6 && $2 ~ /^[0-9]+$/ {
+        print $1 "," $2 "," $3 "," $4 "," $5 "," $6
+    }
+    END { if (!done) exit 3 }
+' "$SERIAL_LOG" > "$RESULTS.tmp" || {
+    echo "Error: no complete benchmark output in $SERIAL_LOG"
+    exit 1
+}
+{
+    echo "test,min,median,max,rate,unit"
+    cat "$RESULTS.tmp"
+} > "$RESULTS"
+rm -f "$RESULTS.tmp"
+cat "$RESULTS"
+
+if [ "$UPDATE" = "--update" ]; then
+    cp "$RESULTS" "$BASELINE"
+    echo "[3/3] Baseline updated: $BASELINE"
+    exit 0
+fi
+
+if [ ! -f "$BASELINE" ]; then
+    echo "[3/3] No baseline at $BASELINE - run 'make bench-baseline' first."
+    exit 1
+fi
+
+echo "[3/3] Comparing medians against $BASELINE (tolerance ${TOLERANCE}%)..."
+awk -F, -v tol="$TOLERANCE" '
+    FNR == 1 { next }
+    NR == FNR { base[$1] = $3; next }
+    {
+        if (!($1 in base)) { printf "  %-14s new test, no baseline\n", $1; next }
+        limit = base[$1] * (100 + tol) / 100
+        change = ($3 - base[$1]) * 100 / base[$1]
+        verdict = ($3 > limit) ? "REGRESSION" : "ok"
+        if ($3 > limit) failed++
+        printf "  %-14s %10d -> %10d cycles (%+.1f%%) %s\n", $1, base[$1], $3, change, verdict
+    }
+    END { exit failed > 0 }
+' "$BASELINE" "$RESULTS" || {
+    echo "Benchmark regression detected."
+    exit 1
+}
+echo "All benchmarks within tolerance."